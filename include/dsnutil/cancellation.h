@@ -0,0 +1,181 @@
+#ifndef CANCELLATION_H
+#define CANCELLATION_H 1
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include <dsnutil/exception.h>
+
+namespace dsn {
+
+/// \brief Exception for tasks that were cancelled before they started
+///
+/// Futures of cancelled tasks hold this exception instead of a result.
+class task_cancelled : public Exception {
+public:
+    using Exception::Exception;
+};
+
+namespace detail {
+    /// \brief State shared by a \p cancellation_source and its tokens
+    struct cancellation_state {
+        std::atomic<bool> cancelled{ false };
+
+        /// \brief Protects \a callbacks (and the transition of \a cancelled)
+        std::mutex mutex;
+
+        /// \brief Callbacks to run on cancellation
+        std::list<std::function<void()> > callbacks;
+    };
+}
+
+/// \brief Callback registered with \p cancellation_token::on_cancel()
+///
+/// Destroying (or resetting) the registration removes the callback unless cancellation has already been
+/// requested, in which case the callback has already run or is running on the cancelling thread.
+class cancellation_registration {
+    friend class cancellation_token;
+    std::weak_ptr<detail::cancellation_state> m_state;
+    std::list<std::function<void()> >::iterator m_callback;
+
+    cancellation_registration(
+        std::weak_ptr<detail::cancellation_state> state, std::list<std::function<void()> >::iterator callback)
+        : m_state(std::move(state))
+        , m_callback(callback)
+    {
+    }
+
+public:
+    cancellation_registration() = default;
+    cancellation_registration(const cancellation_registration&) = delete;
+    cancellation_registration& operator=(const cancellation_registration&) = delete;
+
+    cancellation_registration(cancellation_registration&& other)
+        : m_state(std::move(other.m_state))
+        , m_callback(other.m_callback)
+    {
+        other.m_state.reset();
+    }
+
+    cancellation_registration& operator=(cancellation_registration&& other)
+    {
+        if (this != &other) {
+            reset();
+            m_state = std::move(other.m_state);
+            m_callback = other.m_callback;
+            other.m_state.reset();
+        }
+        return *this;
+    }
+
+    ~cancellation_registration() { reset(); }
+
+    /// \brief Remove the callback if it hasn't been run yet
+    void reset()
+    {
+        if (auto state = m_state.lock()) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->cancelled.load(std::memory_order_relaxed)) {
+                state->callbacks.erase(m_callback);
+            }
+        }
+        m_state.reset();
+    }
+};
+
+/// \brief Read-only view of a cancellation request
+///
+/// Tokens are cheap to copy and are handed to tasks (and \p task_options) so they can check whether
+/// their work is still wanted. A default-constructed token can never be cancelled.
+class cancellation_token {
+    friend class cancellation_source;
+    std::shared_ptr<detail::cancellation_state> m_state;
+
+    explicit cancellation_token(std::shared_ptr<detail::cancellation_state> state)
+        : m_state(std::move(state))
+    {
+    }
+
+public:
+    cancellation_token() = default;
+
+    /// \brief Check whether this token is connected to a \p cancellation_source
+    bool can_be_cancelled() const { return m_state != nullptr; }
+
+    /// \brief Check whether cancellation has been requested
+    bool is_cancelled() const { return m_state && m_state->cancelled.load(std::memory_order_acquire); }
+
+    /// \brief Throw \p dsn::task_cancelled if cancellation has been requested
+    void throw_if_cancelled() const
+    {
+        if (is_cancelled())
+            DSN_EXCEPTION_SIMPLE(dsn::task_cancelled, "Task was cancelled");
+    }
+
+    /// \brief Run \a f once cancellation is requested
+    ///
+    /// \a f runs on the thread that calls \p cancellation_source::cancel(), or right away on the calling
+    /// thread if cancellation has already been requested. It must not throw. Nothing happens for tokens
+    /// that can't be cancelled.
+    ///
+    /// \return Registration that removes \a f again when it is destroyed
+    cancellation_registration on_cancel(std::function<void()> f) const
+    {
+        if (!m_state) {
+            return cancellation_registration();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            if (!m_state->cancelled.load(std::memory_order_relaxed)) {
+                auto it = m_state->callbacks.insert(m_state->callbacks.end(), std::move(f));
+                return cancellation_registration(m_state, it);
+            }
+        }
+        f();
+        return cancellation_registration();
+    }
+};
+
+/// \brief Origin of cancellation requests
+///
+/// All tokens obtained from a source (and from its copies) observe the same request.
+class cancellation_source {
+    std::shared_ptr<detail::cancellation_state> m_state;
+
+public:
+    cancellation_source()
+        : m_state(std::make_shared<detail::cancellation_state>())
+    {
+    }
+
+    /// \brief Request cancellation of all tasks holding a token of this source
+    ///
+    /// Callbacks registered with \p cancellation_token::on_cancel() run on the calling thread before this
+    /// returns (only on the first call).
+    void cancel()
+    {
+        std::list<std::function<void()> > callbacks;
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            if (m_state->cancelled.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            callbacks.swap(m_state->callbacks);
+        }
+        for (auto& callback : callbacks) {
+            callback();
+        }
+    }
+
+    /// \brief Check whether cancellation has been requested
+    bool is_cancelled() const { return m_state->cancelled.load(std::memory_order_acquire); }
+
+    /// \brief Get a token observing this source
+    cancellation_token token() const { return cancellation_token(m_state); }
+};
+}
+
+#endif // CANCELLATION_H
@@ -1,14 +1,157 @@
 #ifndef PARALLEL_FOR_H
 #define PARALLEL_FOR_H
 
+#include <algorithm>
+#include <functional>
 #include <thread>
+#include <type_traits>
+#include <utility>
 
 #include <dsnutil/dsnutil_cpp_Export.h>
 
 namespace dsn {
 
+class ThreadPool;
+
+/// \brief How \p parallel_for() splits its index range among threads
+enum class loop_schedule {
+    /// \brief Chunks are dealt out round-robin up front (OpenMP's \p static)
+    ///
+    /// No synchronization per chunk; by default every thread gets one contiguous block. Best for
+    /// iterations of equal cost.
+    fixed,
+
+    /// \brief Threads grab the next chunk from a shared atomic counter when they're done with one
+    dynamic,
+
+    /// \brief Like \a dynamic, but chunks start large and shrink as the range runs out
+    ///
+    /// Each chunk is a fraction of the remaining indices (but at least the grain size), so there is
+    /// little contention early on and good balance at the end.
+    guided
+};
+
+/// \brief Tunables for \p parallel_for()
+struct dsnutil_cpp_EXPORT loop_options {
+    loop_schedule schedule{ loop_schedule::dynamic };
+
+    /// \brief Number of consecutive indices per chunk (minimum chunk size for \a loop_schedule::guided)
+    ///
+    /// 0 picks a default: one block per thread for \a loop_schedule::fixed, a few chunks per thread for
+    /// \a loop_schedule::dynamic and single indices for \a loop_schedule::guided.
+    size_t grain{ 0 };
+};
+
+dsnutil_cpp_EXPORT ThreadPool& parallel_pool();
+
+namespace detail {
+    dsnutil_cpp_EXPORT void run_loop(ThreadPool& pool, size_t size, const std::function<void(size_t, size_t)>& body,
+        const loop_options& options, size_t helpers);
+
+    /// \brief Value for the \a helpers argument of \a run_loop() that involves all workers of the pool
+    static const size_t all_workers = static_cast<size_t>(-1);
+
+    /// \brief Number of helpers for a loop on at most \a numThreads threads (clamped to # of CPU cores)
+    inline size_t helpers_for(unsigned numThreads)
+    {
+        numThreads = std::min(numThreads, std::thread::hardware_concurrency());
+        return numThreads > 0 ? numThreads - 1 : 0;
+    }
+
+    /// \brief Check whether \p F is a range body \p f(begin, end) rather than a per-index one
+    template <class F, class = void> struct is_range_body : std::false_type {
+    };
+
+    template <class F>
+    struct is_range_body<F, decltype(void(std::declval<F&>()(std::declval<size_t>(), std::declval<size_t>())))>
+        : std::true_type {
+    };
+
+    /// \brief Chunk body that calls a per-index function in a tight loop
+    template <class F> class index_body {
+        F& m_f;
+
+    public:
+        explicit index_body(F& f)
+            : m_f(f)
+        {
+        }
+
+        void operator()(size_t begin, size_t end) const
+        {
+            for (size_t i = begin; i < end; ++i) {
+                m_f(i);
+            }
+        }
+    };
+
+    /// \brief Chunk body that forwards to a range function
+    template <class F> class range_body {
+        F& m_f;
+
+    public:
+        explicit range_body(F& f)
+            : m_f(f)
+        {
+        }
+
+        void operator()(size_t begin, size_t end) const { m_f(begin, end); }
+    };
+
+    template <class F>
+    typename std::enable_if<!is_range_body<F>::value, index_body<F> >::type chunk_body(F& f)
+    {
+        return index_body<F>(f);
+    }
+
+    template <class F> typename std::enable_if<is_range_body<F>::value, range_body<F> >::type chunk_body(F& f)
+    {
+        return range_body<F>(f);
+    }
+}
+
 void dsnutil_cpp_EXPORT parallel_for(const size_t size, std::function<void(const size_t)> func,
     unsigned numThreads = std::thread::hardware_concurrency());
+
+void dsnutil_cpp_EXPORT parallel_for(
+    const size_t size, std::function<void(const size_t)> func, const loop_options& options);
+
+void dsnutil_cpp_EXPORT parallel_for(ThreadPool& pool, const size_t size, std::function<void(const size_t)> func,
+    const loop_options& options = loop_options());
+
+/// \brief Parallelized loop with an inlined body
+///
+/// Takes any callable instead of a \p std::function: either a per-index function \p f(i) or a range
+/// function \p f(begin, end) for the half-open range [begin, end). Per-index bodies are called in a tight
+/// loop within each chunk, so the compiler can inline and vectorize them; only one indirect call per
+/// chunk remains. A callable accepting both signatures is treated as a range function.
+///
+/// \param size Total number of indices
+/// \param f Loop body (per-index or range function)
+/// \param numThreads Max # of threads to use (including the calling one); clamped to # of CPU cores
+///
+/// \throw Rethrows the first exception thrown by \a f once all threads stopped working on the loop
+template <class F> void parallel_for(const size_t size, F&& f, unsigned numThreads = std::thread::hardware_concurrency())
+{
+    detail::run_loop(parallel_pool(), size, detail::chunk_body(f), loop_options(), detail::helpers_for(numThreads));
+}
+
+/// \brief Parallelized loop with an inlined body and explicit scheduling
+///
+/// \see parallel_for(const size_t, F&&, unsigned)
+template <class F> void parallel_for(const size_t size, F&& f, const loop_options& options)
+{
+    detail::run_loop(parallel_pool(), size, detail::chunk_body(f), options, detail::all_workers);
+}
+
+/// \brief Parallelized loop with an inlined body on a given thread pool
+///
+/// \see parallel_for(const size_t, F&&, unsigned)
+template <class F>
+void parallel_for(ThreadPool& pool, const size_t size, F&& f, const loop_options& options = loop_options())
+{
+    detail::run_loop(pool, size, detail::chunk_body(f), options, detail::all_workers);
+}
 }
 
 #endif // PARALLEL_FOR_H
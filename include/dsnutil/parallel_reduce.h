@@ -0,0 +1,128 @@
+#ifndef PARALLEL_REDUCE_H
+#define PARALLEL_REDUCE_H 1
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <dsnutil/parallel_for.h>
+#include <dsnutil/threadpool.h>
+
+namespace dsn {
+
+namespace detail {
+    /// \brief Partial results of the chunks one thread ran, padded so that no two threads write to the same
+    /// cache line
+    template <class T> struct reduce_partials {
+        /// \brief Beginning and partial result of each chunk
+        std::vector<std::pair<size_t, T> > chunks;
+        char padding[64];
+    };
+
+    /// \brief Check whether \p Body is a range body \p body(begin, end, init) rather than a per-index one
+    template <class T, class Body, class = void> struct is_range_reduce_body : std::false_type {
+    };
+
+    template <class T, class Body>
+    struct is_range_reduce_body<T, Body,
+        decltype(void(std::declval<Body&>()(std::declval<size_t>(), std::declval<size_t>(), std::declval<T>())))>
+        : std::true_type {
+    };
+
+    template <class T, class Body>
+    typename std::enable_if<is_range_reduce_body<T, Body>::value>::type accumulate(
+        T& value, size_t begin, size_t end, Body& body)
+    {
+        value = body(begin, end, std::move(value));
+    }
+
+    template <class T, class Body>
+    typename std::enable_if<!is_range_reduce_body<T, Body>::value>::type accumulate(
+        T& value, size_t begin, size_t end, Body& body)
+    {
+        for (size_t i = begin; i < end; ++i) {
+            value = body(std::move(value), i);
+        }
+    }
+
+    /// \brief Fold the partial results of all chunks from left to right in index order
+    template <class T, class Combine>
+    T combine_partials(std::vector<reduce_partials<T> >& partials, T identity, Combine& combine)
+    {
+        std::vector<std::pair<size_t, T> > chunks;
+        for (auto& partial : partials) {
+            for (auto& chunk : partial.chunks) {
+                chunks.push_back(std::move(chunk));
+            }
+        }
+        if (chunks.empty()) {
+            return identity;
+        }
+
+        std::sort(chunks.begin(), chunks.end(),
+            [](const std::pair<size_t, T>& a, const std::pair<size_t, T>& b) { return a.first < b.first; });
+        T result = std::move(chunks.front().second);
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            result = combine(std::move(result), std::move(chunks[i].second));
+        }
+        return result;
+    }
+}
+
+/// \brief Parallel reduction on a given thread pool
+///
+/// Runs on the same backend as \p parallel_for(): the calling thread and the pool's workers process
+/// contiguous chunks of [0, \a size). Every chunk is folded into its own partial result that is kept by
+/// the thread that ran it, so the loop doesn't touch any shared data; the partials are combined in index
+/// order at the end.
+///
+/// The body is either a range function \p body(begin, end, init) that returns \p init with the indices
+/// [begin, end) folded in, or a per-index function \p body(acc, i) that returns \p acc with index \p i
+/// folded in. \a combine only ever merges adjacent ranges in index order, so it has to be associative but
+/// not commutative (e.g. string concatenation works). \a identity must not change values it is combined
+/// with since every chunk starts from it.
+///
+/// \param pool Thread pool whose workers help with the reduction
+/// \param size Total number of indices
+/// \param identity Initial value of every partial result (e.g. 0 for sums)
+/// \param body Range or per-index function that folds indices into a partial result
+/// \param combine Function that merges two partial results
+/// \param options How the indices are split into chunks
+///
+/// \return Combined result or \a identity if \a size is zero
+///
+/// \throw Rethrows the first exception thrown by \a body once all threads stopped working on the loop
+template <class T, class Body, class Combine>
+T parallel_reduce(ThreadPool& pool, const size_t size, T identity, Body&& body, Combine&& combine,
+    const loop_options& options = loop_options())
+{
+    // one slot per worker plus one for a calling thread that isn't a worker of the pool
+    const size_t slots = pool.worker_slots() + 1;
+    std::vector<detail::reduce_partials<T> > partials(slots);
+
+    detail::run_loop(pool, size,
+        [&](size_t begin, size_t end) {
+            const size_t index = pool.worker_index();
+            T value(identity);
+            detail::accumulate(value, begin, end, body);
+            partials[index == ThreadPool::no_worker ? slots - 1 : index].chunks.emplace_back(begin, std::move(value));
+        },
+        options, detail::all_workers);
+
+    return detail::combine_partials(partials, std::move(identity), combine);
+}
+
+/// \brief Parallel reduction on the shared \p parallel_pool()
+///
+/// \see parallel_reduce(ThreadPool&, const size_t, T, Body&&, Combine&&, const loop_options&)
+template <class T, class Body, class Combine>
+T parallel_reduce(const size_t size, T identity, Body&& body, Combine&& combine,
+    const loop_options& options = loop_options())
+{
+    return parallel_reduce(parallel_pool(), size, std::move(identity), std::forward<Body>(body),
+        std::forward<Combine>(combine), options);
+}
+}
+
+#endif // PARALLEL_REDUCE_H
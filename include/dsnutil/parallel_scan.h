@@ -0,0 +1,204 @@
+#ifndef PARALLEL_SCAN_H
+#define PARALLEL_SCAN_H 1
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <dsnutil/parallel_for.h>
+#include <dsnutil/threadpool.h>
+
+namespace dsn {
+
+namespace detail {
+    /// \brief Minimum number of elements per block of a parallel scan
+    static const size_t min_scan_block = 1024;
+
+    /// \brief Number of blocks to split a scan of \a size elements on \a pool into (1 = scan serially)
+    inline size_t scan_blocks(ThreadPool& pool, size_t size)
+    {
+        const size_t participants = pool.num_workers() + (pool.is_worker_thread() ? 0 : 1);
+        return std::max<size_t>(std::min(participants * 4, size / min_scan_block), 1);
+    }
+
+    /// \brief Two-pass blocked scan
+    ///
+    /// The first pass reduces every block to its sum in parallel, a serial pass turns the block sums into
+    /// each block's carry-in and the second pass scans the blocks in parallel starting from their carry-in.
+    /// \a op is only ever applied in element order, so it needs to be associative but not commutative.
+    ///
+    /// \param carry Initial value for the first block; \p nullptr for an inclusive scan without one
+    template <class T, class RandomIt1, class RandomIt2, class BinaryOp>
+    void blocked_scan(ThreadPool& pool, RandomIt1 first, size_t size, RandomIt2 d_first, const T* carry, bool inclusive,
+        BinaryOp& op)
+    {
+        // rounding the block size up can leave fewer non-empty blocks than requested, so recount them
+        const size_t requested = scan_blocks(pool, size);
+        const size_t block_size = (size + requested - 1) / requested;
+        const size_t blocks = (size + block_size - 1) / block_size;
+        const size_t last_block = blocks - 1;
+
+        // carry-ins only depend on the blocks before them, so the last block's sum isn't needed
+        std::vector<T> sums;
+        sums.reserve(blocks);
+        for (size_t b = 0; b < blocks; ++b) {
+            sums.emplace_back(*first);
+        }
+        parallel_for(pool, last_block, [&](size_t b) {
+            RandomIt1 it = first + b * block_size;
+            T sum = *it;
+            for (size_t i = 1; i < block_size; ++i) {
+                sum = op(std::move(sum), *++it);
+            }
+            sums[b] = std::move(sum);
+        });
+
+        // turn the block sums into carry-ins (sums[b] becomes the carry-in of block b + 1)
+        if (carry && last_block > 0) {
+            sums[0] = op(*carry, std::move(sums[0]));
+        }
+        for (size_t b = 1; b < last_block; ++b) {
+            sums[b] = op(std::move(sums[b - 1]), std::move(sums[b]));
+        }
+
+        parallel_for(pool, blocks, [&](size_t b) {
+            const size_t begin = b * block_size;
+            const size_t end = std::min(begin + block_size, size);
+            const T* in = b > 0 ? &sums[b - 1] : carry;
+            RandomIt1 src = first + begin;
+            RandomIt2 dst = d_first + begin;
+            if (inclusive) {
+                T acc = in ? op(*in, *src) : T(*src);
+                *dst = acc;
+                for (size_t i = begin + 1; i < end; ++i) {
+                    acc = op(std::move(acc), *++src);
+                    *++dst = acc;
+                }
+            } else {
+                T acc = *in;
+                for (size_t i = begin; i < end; ++i, ++src, ++dst) {
+                    // read before writing so that the scan also works in place
+                    T next = op(acc, *src);
+                    *dst = std::move(acc);
+                    acc = std::move(next);
+                }
+            }
+        });
+    }
+}
+
+/// \brief Parallel inclusive prefix scan on a given thread pool
+///
+/// Writes \p x[0], \p x[0] op \p x[1], ... to \a d_first like \p std::inclusive_scan. Uses the two-pass
+/// blocked algorithm: each element is read twice, but all passes except the one over the per-block sums
+/// run on the calling thread and the pool's workers. Short ranges are scanned serially.
+///
+/// \param pool Thread pool whose workers help with the scan
+/// \param first Beginning of the input range
+/// \param last End of the input range
+/// \param d_first Beginning of the output range (may be equal to \a first)
+/// \param op Associative binary operation (doesn't have to be commutative)
+///
+/// \return Iterator past the last element written
+///
+/// \throw Rethrows the first exception thrown by \a op
+template <class RandomIt1, class RandomIt2, class BinaryOp>
+RandomIt2 parallel_inclusive_scan(ThreadPool& pool, RandomIt1 first, RandomIt1 last, RandomIt2 d_first, BinaryOp op)
+{
+    typedef typename std::iterator_traits<RandomIt1>::value_type value_type;
+
+    const size_t size = static_cast<size_t>(std::distance(first, last));
+    if (size > 0) {
+        detail::blocked_scan<value_type>(pool, first, size, d_first, nullptr, true, op);
+    }
+    return d_first + size;
+}
+
+/// \brief Parallel inclusive prefix sum on a given thread pool
+///
+/// \see parallel_inclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, BinaryOp)
+template <class RandomIt1, class RandomIt2>
+RandomIt2 parallel_inclusive_scan(ThreadPool& pool, RandomIt1 first, RandomIt1 last, RandomIt2 d_first)
+{
+    return parallel_inclusive_scan(
+        pool, first, last, d_first, std::plus<typename std::iterator_traits<RandomIt1>::value_type>());
+}
+
+/// \brief Parallel inclusive prefix scan on the shared \p parallel_pool()
+///
+/// \see parallel_inclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, BinaryOp)
+template <class RandomIt1, class RandomIt2, class BinaryOp>
+RandomIt2 parallel_inclusive_scan(RandomIt1 first, RandomIt1 last, RandomIt2 d_first, BinaryOp op)
+{
+    return parallel_inclusive_scan(parallel_pool(), first, last, d_first, std::move(op));
+}
+
+/// \brief Parallel inclusive prefix sum on the shared \p parallel_pool()
+///
+/// \see parallel_inclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, BinaryOp)
+template <class RandomIt1, class RandomIt2>
+RandomIt2 parallel_inclusive_scan(RandomIt1 first, RandomIt1 last, RandomIt2 d_first)
+{
+    return parallel_inclusive_scan(parallel_pool(), first, last, d_first);
+}
+
+/// \brief Parallel exclusive prefix scan on a given thread pool
+///
+/// Writes \a init, \a init op \p x[0], \a init op \p x[0] op \p x[1], ... to \a d_first like
+/// \p std::exclusive_scan (the last input element only contributes to the total, which isn't written).
+///
+/// \see parallel_inclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, BinaryOp)
+///
+/// \param pool Thread pool whose workers help with the scan
+/// \param first Beginning of the input range
+/// \param last End of the input range
+/// \param d_first Beginning of the output range (may be equal to \a first)
+/// \param init Value of the first output element (e.g. 0 for offsets); \p T has to be constructible from the
+///     input's value type
+/// \param op Associative binary operation (doesn't have to be commutative)
+///
+/// \return Iterator past the last element written
+///
+/// \throw Rethrows the first exception thrown by \a op
+template <class RandomIt1, class RandomIt2, class T, class BinaryOp>
+RandomIt2 parallel_exclusive_scan(
+    ThreadPool& pool, RandomIt1 first, RandomIt1 last, RandomIt2 d_first, T init, BinaryOp op)
+{
+    const size_t size = static_cast<size_t>(std::distance(first, last));
+    if (size > 0) {
+        detail::blocked_scan<T>(pool, first, size, d_first, &init, false, op);
+    }
+    return d_first + size;
+}
+
+/// \brief Parallel exclusive prefix sum on a given thread pool
+///
+/// \see parallel_exclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, T, BinaryOp)
+template <class RandomIt1, class RandomIt2, class T>
+RandomIt2 parallel_exclusive_scan(ThreadPool& pool, RandomIt1 first, RandomIt1 last, RandomIt2 d_first, T init)
+{
+    return parallel_exclusive_scan(pool, first, last, d_first, std::move(init), std::plus<T>());
+}
+
+/// \brief Parallel exclusive prefix scan on the shared \p parallel_pool()
+///
+/// \see parallel_exclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, T, BinaryOp)
+template <class RandomIt1, class RandomIt2, class T, class BinaryOp>
+RandomIt2 parallel_exclusive_scan(RandomIt1 first, RandomIt1 last, RandomIt2 d_first, T init, BinaryOp op)
+{
+    return parallel_exclusive_scan(parallel_pool(), first, last, d_first, std::move(init), std::move(op));
+}
+
+/// \brief Parallel exclusive prefix sum on the shared \p parallel_pool()
+///
+/// \see parallel_exclusive_scan(ThreadPool&, RandomIt1, RandomIt1, RandomIt2, T, BinaryOp)
+template <class RandomIt1, class RandomIt2, class T>
+RandomIt2 parallel_exclusive_scan(RandomIt1 first, RandomIt1 last, RandomIt2 d_first, T init)
+{
+    return parallel_exclusive_scan(parallel_pool(), first, last, d_first, std::move(init));
+}
+}
+
+#endif // PARALLEL_SCAN_H
@@ -0,0 +1,215 @@
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H 1
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include <dsnutil/parallel_for.h>
+#include <dsnutil/threadpool.h>
+
+namespace dsn {
+
+namespace detail {
+    /// \brief Minimum number of elements per initially sorted run of a parallel sort
+    static const size_t min_sort_block = 1 << 14;
+
+    /// \brief Split point of a stable merge
+    ///
+    /// \return Number of elements of \a a among the first \a d elements of the merge of \a a and \a b
+    template <class It1, class It2, class Compare>
+    size_t merge_split(It1 a, size_t na, It2 b, size_t nb, size_t d, Compare& comp)
+    {
+        size_t lo = d > nb ? d - nb : 0;
+        size_t hi = std::min(d, na);
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            // elements of a come first on ties, so b[j - 1] precedes a[mid] only if it's strictly smaller
+            if (comp(b[d - mid - 1], a[mid])) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        return lo;
+    }
+
+    /// \brief Part of a merge: output elements [begin, end) of merging run pair \a pair
+    struct merge_piece {
+        size_t pair;
+        size_t begin;
+        size_t end;
+    };
+
+    /// \brief Merge neighbouring runs from \a src into \a dst
+    ///
+    /// \param runs Bounds of the runs before this round (run \p r covers [runs[r], runs[r + 1]))
+    /// \param pairs Bounds of the merged runs (pair \p p covers runs 2p and 2p + 1)
+    template <class SrcIt, class DstIt, class Compare>
+    void merge_round(ThreadPool& pool, SrcIt src, DstIt dst, const std::vector<size_t>& runs,
+        const std::vector<size_t>& pairs, const std::vector<merge_piece>& pieces, Compare& comp)
+    {
+        parallel_for(pool, pieces.size(), [&](size_t i) {
+            const merge_piece& job = pieces[i];
+            const size_t begin = pairs[job.pair];
+            const size_t mid = runs[2 * job.pair + 1];
+            const size_t end = pairs[job.pair + 1];
+            SrcIt a = src + begin;
+            SrcIt b = src + mid;
+            const size_t na = mid - begin;
+            const size_t nb = end - mid;
+            const size_t a0 = merge_split(a, na, b, nb, job.begin, comp);
+            const size_t a1 = merge_split(a, na, b, nb, job.end, comp);
+            std::merge(std::make_move_iterator(a + a0), std::make_move_iterator(a + a1),
+                std::make_move_iterator(b + (job.begin - a0)), std::make_move_iterator(b + (job.end - a1)),
+                dst + begin + job.begin, comp);
+        });
+    }
+
+    /// \brief Parallel merge sort
+    ///
+    /// Sorts runs of at least \a min_sort_block elements in parallel with \a sort_run and then merges
+    /// neighbouring runs pairwise between the range and a buffer. Every merge is split into pieces of equal
+    /// output size (by binary search for the split points), so all rounds use all threads, including the
+    /// last one that produces a single run. Merging is stable, so the result is stable if \a sort_run is.
+    template <class RandomIt, class Compare, class SortRun>
+    void merge_sort(ThreadPool& pool, RandomIt first, RandomIt last, Compare& comp, SortRun sort_run)
+    {
+        typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+
+        const size_t size = static_cast<size_t>(std::distance(first, last));
+        const size_t participants = pool.num_workers() + (pool.is_worker_thread() ? 0 : 1);
+        const size_t runs = std::min(participants * 2, size / min_sort_block);
+        if (runs < 2) {
+            sort_run(first, last, comp);
+            return;
+        }
+
+        // run r covers [bounds[r], bounds[r + 1])
+        std::vector<size_t> bounds(runs + 1);
+        for (size_t r = 0; r <= runs; ++r) {
+            bounds[r] = r * size / runs;
+        }
+        parallel_for(pool, runs, [&](size_t r) { sort_run(first + bounds[r], first + bounds[r + 1], comp); });
+
+        std::unique_ptr<value_type[]> buffer(new value_type[size]);
+        const size_t pieces_per_round = participants * 4;
+        bool in_buffer{ false };
+        while (bounds.size() > 2) {
+            // merge runs 2p and 2p + 1 into one (an odd run out is moved over as is)
+            std::vector<size_t> pairs;
+            for (size_t r = 0; r < bounds.size(); r += 2) {
+                pairs.push_back(bounds[r]);
+            }
+            if (pairs.back() != size) {
+                pairs.push_back(size);
+            }
+
+            std::vector<merge_piece> pieces;
+            for (size_t p = 0; p + 1 < pairs.size(); ++p) {
+                const size_t length = pairs[p + 1] - pairs[p];
+                const size_t count = std::max<size_t>(length * pieces_per_round / size, 1);
+                for (size_t k = 0; k < count; ++k) {
+                    pieces.push_back(merge_piece{ p, k * length / count, (k + 1) * length / count });
+                }
+            }
+
+            if (in_buffer) {
+                merge_round(pool, buffer.get(), first, bounds, pairs, pieces, comp);
+            } else {
+                merge_round(pool, first, buffer.get(), bounds, pairs, pieces, comp);
+            }
+            in_buffer = !in_buffer;
+            bounds.swap(pairs);
+        }
+
+        if (in_buffer) {
+            parallel_for(pool, size, [&](size_t begin, size_t end) {
+                std::move(buffer.get() + begin, buffer.get() + end, first + begin);
+            });
+        }
+    }
+}
+
+/// \brief Sort a range in parallel on a given thread pool
+///
+/// Parallel merge sort: runs are sorted with \p std::sort by the calling thread and the pool's workers,
+/// then merged in parallel through a temporary buffer of the same size as the range. Ranges of less than
+/// two runs of 16384 elements are sorted serially.
+///
+/// \note The value type has to be default constructible (for the buffer) in addition to the requirements
+/// of \p std::sort.
+///
+/// \param pool Thread pool whose workers help with sorting
+/// \param first Beginning of the range
+/// \param last End of the range
+/// \param comp Strict weak ordering
+///
+/// \throw Rethrows the first exception thrown by \a comp or by moving elements; the range is left in a valid
+///     but unspecified state
+template <class RandomIt, class Compare> void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last, Compare comp)
+{
+    detail::merge_sort(pool, first, last, comp, [](RandomIt begin, RandomIt end, Compare& c) { std::sort(begin, end, c); });
+}
+
+/// \brief Sort a range in parallel on a given thread pool, keeping equal elements in order
+///
+/// Same as \a parallel_sort() but sorts the runs with \p std::stable_sort; merging is stable anyway.
+///
+/// \see parallel_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt, class Compare>
+void parallel_stable_sort(ThreadPool& pool, RandomIt first, RandomIt last, Compare comp)
+{
+    detail::merge_sort(
+        pool, first, last, comp, [](RandomIt begin, RandomIt end, Compare& c) { std::stable_sort(begin, end, c); });
+}
+
+/// \brief Sort a range in ascending order in parallel on a given thread pool
+///
+/// \see parallel_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt> void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last)
+{
+    parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+/// \brief Stable sort in ascending order in parallel on a given thread pool
+///
+/// \see parallel_stable_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt> void parallel_stable_sort(ThreadPool& pool, RandomIt first, RandomIt last)
+{
+    parallel_stable_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+/// \brief Sort a range in parallel on the shared \p parallel_pool()
+///
+/// \see parallel_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt, class Compare> void parallel_sort(RandomIt first, RandomIt last, Compare comp)
+{
+    parallel_sort(parallel_pool(), first, last, std::move(comp));
+}
+
+/// \brief Stable sort in parallel on the shared \p parallel_pool()
+///
+/// \see parallel_stable_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt, class Compare> void parallel_stable_sort(RandomIt first, RandomIt last, Compare comp)
+{
+    parallel_stable_sort(parallel_pool(), first, last, std::move(comp));
+}
+
+/// \brief Sort a range in ascending order in parallel on the shared \p parallel_pool()
+///
+/// \see parallel_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt> void parallel_sort(RandomIt first, RandomIt last) { parallel_sort(parallel_pool(), first, last); }
+
+/// \brief Stable sort in ascending order in parallel on the shared \p parallel_pool()
+///
+/// \see parallel_stable_sort(ThreadPool&, RandomIt, RandomIt, Compare)
+template <class RandomIt> void parallel_stable_sort(RandomIt first, RandomIt last)
+{
+    parallel_stable_sort(parallel_pool(), first, last);
+}
+}
+
+#endif // PARALLEL_SORT_H
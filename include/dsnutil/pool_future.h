@@ -0,0 +1,569 @@
+#ifndef POOL_FUTURE_H
+#define POOL_FUTURE_H 1
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <dsnutil/chrono/clock_type.hpp>
+#include <dsnutil/compiler_features.h>
+#include <dsnutil/dsnutil_cpp_Export.h>
+#include <dsnutil/task.h>
+#include <dsnutil/threadpool.h>
+
+namespace dsn {
+
+template <class T> class pool_future;
+template <class T> class pool_promise;
+
+namespace detail {
+    /// \brief Result slot of a shared future state
+    template <class T> class future_value {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type m_data;
+        bool m_set{ false };
+
+    public:
+        future_value() = default;
+        future_value(const future_value&) = delete;
+        future_value& operator=(const future_value&) = delete;
+        ~future_value()
+        {
+            if (m_set) {
+                get().~T();
+            }
+        }
+
+        template <class U> void set(U&& value)
+        {
+            new (&m_data) T(std::forward<U>(value));
+            m_set = true;
+        }
+
+        T& get() { return *reinterpret_cast<T*>(&m_data); }
+    };
+
+    template <> class future_value<void> {
+    };
+
+    /// \brief Type-independent part of the state shared by \p pool_promise and \p pool_future
+    ///
+    /// Callbacks registered with \a add_callback() run on the thread that makes the state ready (or
+    /// immediately if it already is); they're used to schedule continuations onto the pool.
+    class dsnutil_cpp_EXPORT future_state_base {
+        std::mutex m_mutex;
+        std::condition_variable m_ready_condition;
+        bool m_ready{ false };
+        std::exception_ptr m_exception;
+        bool m_cancelled{ false };
+        std::vector<dsn::task> m_callbacks;
+
+        /// \brief Pool that runs continuations (\p nullptr runs them inline)
+        ThreadPool* m_pool;
+
+    protected:
+        std::unique_lock<std::mutex> lock_unsatisfied();
+        void make_ready(std::unique_lock<std::mutex>& lock);
+
+    public:
+        explicit future_state_base(ThreadPool* pool);
+        virtual ~future_state_base();
+
+        future_state_base(const future_state_base&) = delete;
+        future_state_base& operator=(const future_state_base&) = delete;
+
+        ThreadPool* pool() const { return m_pool; }
+
+        bool is_ready();
+        bool is_cancelled();
+        void wait();
+        bool wait_until(const dsn::chrono::clock_type::time_point& deadline);
+
+        void set_exception(std::exception_ptr exception);
+        void rethrow_if_failed();
+
+        void add_callback(dsn::task&& callback);
+    };
+
+    template <class T> class future_state : public future_state_base {
+        future_value<T> m_value;
+
+    public:
+        explicit future_state(ThreadPool* pool)
+            : future_state_base(pool)
+        {
+        }
+
+        template <class U> void set_value(U&& value)
+        {
+            auto lock = lock_unsatisfied();
+            m_value.set(std::forward<U>(value));
+            make_ready(lock);
+        }
+
+        T get()
+        {
+            wait();
+            rethrow_if_failed();
+            return std::move(m_value.get());
+        }
+    };
+
+    template <> class future_state<void> : public future_state_base {
+    public:
+        explicit future_state(ThreadPool* pool)
+            : future_state_base(pool)
+        {
+        }
+
+        void set_value()
+        {
+            auto lock = lock_unsatisfied();
+            make_ready(lock);
+        }
+
+        void get()
+        {
+            wait();
+            rethrow_if_failed();
+        }
+    };
+
+    /// \brief Run \a f and store its result (or exception) in \a state
+    template <class R, class F> void fulfil(future_state<R>& state, F& f, std::false_type)
+    {
+        try {
+            state.set_value(f());
+        } catch (...) {
+            state.set_exception(std::current_exception());
+        }
+    }
+
+    template <class R, class F> void fulfil(future_state<R>& state, F& f, std::true_type)
+    {
+        try {
+            f();
+            state.set_value();
+        } catch (...) {
+            state.set_exception(std::current_exception());
+        }
+    }
+
+    template <class R, class F> void fulfil(future_state<R>& state, F& f)
+    {
+        fulfil(state, f, std::is_void<R>());
+    }
+
+    /// \brief Task that runs \a F on the pool and fulfils the state of a future
+    ///
+    /// If the pool discards the task without running it the future is completed with
+    /// \p std::future_errc::broken_promise.
+    template <class R, class F> class pool_call {
+        std::shared_ptr<future_state<R> > m_state;
+        F m_f;
+
+    public:
+        pool_call(std::shared_ptr<future_state<R> > state, F&& f)
+            : m_state(std::move(state))
+            , m_f(std::move(f))
+        {
+        }
+
+        pool_call(pool_call&& other) = default;
+
+        ~pool_call()
+        {
+            if (m_state) {
+                m_state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+        }
+
+        /// \brief Run the task (does nothing if it was moved from)
+        void operator()()
+        {
+            if (auto state = std::move(m_state)) {
+                fulfil(*state, m_f);
+            }
+        }
+    };
+
+    /// \brief A \p pool_call that checks its token completes the future with \p dsn::task_cancelled by itself
+    template <class R, class F> struct checks_token<pool_call<R, cancellable_call<F> > > : std::true_type {
+    };
+
+    /// \brief Queue \a call on \a pool, falling back to running it inline if there is no (running) pool
+    ///
+    /// A call rejected by a full queue has already been consumed and completes its future with
+    /// \p std::future_errc::broken_promise; a stopped pool leaves it untouched so it runs inline (unless
+    /// the pool stops while the call is being queued, which consumes it like a full queue).
+    template <class R, class F> void schedule(ThreadPool* pool, pool_call<R, F>&& call)
+    {
+        if (pool) {
+            try {
+                pool->post(std::move(call));
+                return;
+            } catch (const dsn::Exception&) {
+                // pool is stopped or its queue is full
+            }
+        }
+        call();
+    }
+
+    /// \brief Access to the shared state of a \p pool_future
+    struct future_access {
+        template <class T> static const std::shared_ptr<future_state<T> >& state(const pool_future<T>& future)
+        {
+            return future.m_state;
+        }
+
+        template <class T> static pool_future<T> make(std::shared_ptr<future_state<T> > state)
+        {
+            return pool_future<T>(std::move(state));
+        }
+    };
+}
+
+/// \brief Future whose continuations are scheduled on a \p ThreadPool
+///
+/// Works like \p std::future but additionally supports \a then() to attach work that is queued on
+/// the pool as soon as this future becomes ready, so multi-stage processing never parks a worker
+/// in \a get(). Futures are move-only and their result can be retrieved once.
+template <class T> class pool_future {
+    friend struct detail::future_access;
+    std::shared_ptr<detail::future_state<T> > m_state;
+
+    explicit pool_future(std::shared_ptr<detail::future_state<T> > state)
+        : m_state(std::move(state))
+    {
+    }
+
+    /// \brief Callback that queues a continuation once its predecessor is ready
+    template <class R, class F> class continuation {
+        std::shared_ptr<detail::future_state<T> > m_predecessor;
+        std::shared_ptr<detail::future_state<R> > m_next;
+        F m_f;
+
+        /// \brief Bind the ready predecessor to the continuation
+        class invoke {
+            std::shared_ptr<detail::future_state<T> > m_predecessor;
+            F m_f;
+
+        public:
+            invoke(std::shared_ptr<detail::future_state<T> > predecessor, F&& f)
+                : m_predecessor(std::move(predecessor))
+                , m_f(std::move(f))
+            {
+            }
+
+            R operator()() { return m_f(pool_future<T>(std::move(m_predecessor))); }
+        };
+
+    public:
+        continuation(std::shared_ptr<detail::future_state<T> > predecessor,
+            std::shared_ptr<detail::future_state<R> > next, F&& f)
+            : m_predecessor(std::move(predecessor))
+            , m_next(std::move(next))
+            , m_f(std::move(f))
+        {
+        }
+
+        void operator()()
+        {
+            ThreadPool* pool = m_next->pool();
+            detail::schedule(
+                pool, detail::pool_call<R, invoke>(std::move(m_next), invoke(std::move(m_predecessor), std::move(m_f))));
+        }
+    };
+
+public:
+    pool_future() dsnutil_cpp_NOEXCEPT {}
+    pool_future(pool_future&&) = default;
+    pool_future& operator=(pool_future&&) = default;
+    pool_future(const pool_future&) = delete;
+    pool_future& operator=(const pool_future&) = delete;
+
+    /// \brief Check whether this future refers to a shared state
+    bool valid() const dsnutil_cpp_NOEXCEPT { return m_state != nullptr; }
+
+    /// \brief Check whether the result is available without blocking
+    bool is_ready() const { return m_state->is_ready(); }
+
+    /// \brief Check whether the task producing the result was cancelled before it started
+    ///
+    /// \return true if the future is ready and holds a \p dsn::task_cancelled exception
+    bool is_cancelled() const { return m_state->is_cancelled(); }
+
+    /// \brief Block until the result is available
+    void wait() const { m_state->wait(); }
+
+    /// \brief Block until the result is available or \a timeout expired
+    template <class Rep, class Period> std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        return m_state->wait_until(dsn::chrono::clock_type::now()
+                   + std::chrono::duration_cast<dsn::chrono::clock_type::duration>(timeout))
+            ? std::future_status::ready
+            : std::future_status::timeout;
+    }
+
+    /// \brief Wait for and retrieve the result
+    ///
+    /// Invalidates this future.
+    ///
+    /// \throw Rethrows the exception stored in the shared state
+    T get()
+    {
+        auto state = std::move(m_state);
+        return state->get();
+    }
+
+    /// \brief Attach a continuation
+    ///
+    /// Once this future is ready \a f is queued on the pool that produced it and receives the ready
+    /// future as its only argument (so it can inspect the value or exception). If the pool has been
+    /// stopped in the meantime \a f runs on the thread that completed this future instead.
+    ///
+    /// Invalidates this future.
+    ///
+    /// \param f Callable taking a \p pool_future<T>
+    ///
+    /// \return Future for the result of \a f
+    template <class F>
+    auto then(F&& f) -> pool_future<decltype(std::declval<typename std::decay<F>::type&>()(std::declval<pool_future<T> >()))>
+    {
+        typedef typename std::decay<F>::type function_type;
+        typedef decltype(std::declval<function_type&>()(std::declval<pool_future<T> >())) result_type;
+
+        auto predecessor = std::move(m_state);
+        auto next = std::make_shared<detail::future_state<result_type> >(predecessor->pool());
+        auto* target = predecessor.get();
+        target->add_callback(
+            continuation<result_type, function_type>(std::move(predecessor), next, function_type(std::forward<F>(f))));
+        return detail::future_access::make(std::move(next));
+    }
+};
+
+/// \brief Producer side of a \p pool_future
+///
+/// A promise that is destroyed without being satisfied completes its future with
+/// \p std::future_errc::broken_promise.
+template <class T> class pool_promise {
+    std::shared_ptr<detail::future_state<T> > m_state;
+    bool m_retrieved{ false };
+
+public:
+    /// \brief Create a promise whose continuations run on \a pool
+    explicit pool_promise(ThreadPool& pool)
+        : m_state(std::make_shared<detail::future_state<T> >(&pool))
+    {
+    }
+
+    /// \brief Create a promise whose continuations run inline on the thread that satisfies it
+    pool_promise()
+        : m_state(std::make_shared<detail::future_state<T> >(nullptr))
+    {
+    }
+
+    pool_promise(pool_promise&&) = default;
+    pool_promise& operator=(pool_promise&& other)
+    {
+        abandon();
+        m_state = std::move(other.m_state);
+        m_retrieved = other.m_retrieved;
+        return *this;
+    }
+    pool_promise(const pool_promise&) = delete;
+    pool_promise& operator=(const pool_promise&) = delete;
+
+    ~pool_promise() { abandon(); }
+
+    /// \brief Get the future for this promise (only once)
+    pool_future<T> get_future()
+    {
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        if (m_retrieved) {
+            throw std::future_error(std::future_errc::future_already_retrieved);
+        }
+        m_retrieved = true;
+        return detail::future_access::make(m_state);
+    }
+
+    template <class... U> void set_value(U&&... value)
+    {
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        m_state->set_value(std::forward<U>(value)...);
+    }
+
+    void set_exception(std::exception_ptr exception)
+    {
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        m_state->set_exception(exception);
+    }
+
+private:
+    void abandon()
+    {
+        if (m_state && !m_state->is_ready()) {
+            try {
+                m_state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            } catch (const std::future_error&) {
+                // satisfied concurrently
+            }
+        }
+    }
+};
+
+/// \brief Run a task on \a pool and get a \p pool_future for its result
+///
+/// \param pool Thread pool that runs the task and any continuations attached to its future
+/// \param options Scheduling options for the task
+/// \param f Function that shall be executed in the thread pool (this can be anything callable)
+/// \param args Variable arguments to \a f (may be move-only)
+template <class F, class... Args>
+auto async(ThreadPool& pool, const task_options& options, F&& f, Args&&... args)
+    -> pool_future<decltype(detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...)())>
+{
+    auto bound = detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...);
+    typedef decltype(bound()) result_type;
+
+    typedef detail::cancellable_call<decltype(bound)> cancellable_type;
+
+    auto state = std::make_shared<detail::future_state<result_type> >(&pool);
+    if (options.token.can_be_cancelled()) {
+        // check the token here so the future gets dsn::task_cancelled rather than a broken promise
+        pool.post(options,
+            detail::pool_call<result_type, cancellable_type>(state, cancellable_type(options.token, std::move(bound))));
+    } else {
+        pool.post(options, detail::pool_call<result_type, decltype(bound)>(state, std::move(bound)));
+    }
+    return detail::future_access::make(std::move(state));
+}
+
+/// \brief Run a task on \a pool and get a \p pool_future for its result
+///
+/// \see async(ThreadPool&, const task_options&, F&&, Args&&...)
+template <class F, class... Args, class = typename detail::disable_if_task_options<F>::type>
+auto async(ThreadPool& pool, F&& f, Args&&... args)
+    -> pool_future<decltype(detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...)())>
+{
+    return async(pool, task_options(), std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+/// \brief Combine futures into one that is ready once all of them are
+///
+/// \param first Iterator to the first \p pool_future (the futures are moved from)
+/// \param last Iterator past the last \p pool_future
+///
+/// \return Future for the (ready) input futures in their original order
+template <class InputIt>
+pool_future<std::vector<typename std::iterator_traits<InputIt>::value_type> > when_all(InputIt first, InputIt last)
+{
+    typedef typename std::iterator_traits<InputIt>::value_type future_type;
+    typedef std::vector<future_type> sequence_type;
+
+    struct context {
+        sequence_type futures;
+        std::atomic<size_t> remaining{ 0 };
+        std::shared_ptr<detail::future_state<sequence_type> > state;
+    };
+
+    auto ctx = std::make_shared<context>();
+    for (; first != last; ++first) {
+        ctx->futures.push_back(std::move(*first));
+    }
+
+    ThreadPool* pool = ctx->futures.empty() ? nullptr : detail::future_access::state(ctx->futures.front())->pool();
+    ctx->state = std::make_shared<detail::future_state<sequence_type> >(pool);
+    auto result = detail::future_access::make(ctx->state);
+    if (ctx->futures.empty()) {
+        ctx->state->set_value(sequence_type());
+        return result;
+    }
+
+    // the last callback moves the futures out of the context, so take their states up front
+    std::vector<std::shared_ptr<detail::future_state_base> > states;
+    for (auto& future : ctx->futures) {
+        states.push_back(detail::future_access::state(future));
+    }
+    ctx->remaining = states.size();
+
+    for (auto& state : states) {
+        state->add_callback([ctx]() {
+            if (--ctx->remaining == 0) {
+                ctx->state->set_value(std::move(ctx->futures));
+            }
+        });
+    }
+    return result;
+}
+
+/// \brief Result of \a when_any()
+template <class Sequence> struct when_any_result {
+    /// \brief Position of the first future that became ready
+    size_t index;
+
+    /// \brief All input futures in their original order
+    Sequence futures;
+};
+
+/// \brief Combine futures into one that is ready as soon as any of them is
+///
+/// \param first Iterator to the first \p pool_future (the futures are moved from)
+/// \param last Iterator past the last \p pool_future
+///
+/// \return Future for the input futures and the index of the one that became ready first
+template <class InputIt>
+pool_future<when_any_result<std::vector<typename std::iterator_traits<InputIt>::value_type> > > when_any(
+    InputIt first, InputIt last)
+{
+    typedef typename std::iterator_traits<InputIt>::value_type future_type;
+    typedef when_any_result<std::vector<future_type> > result_type;
+
+    struct context {
+        std::vector<future_type> futures;
+        std::atomic<bool> done{ false };
+        std::shared_ptr<detail::future_state<result_type> > state;
+    };
+
+    auto ctx = std::make_shared<context>();
+    for (; first != last; ++first) {
+        ctx->futures.push_back(std::move(*first));
+    }
+
+    ThreadPool* pool = ctx->futures.empty() ? nullptr : detail::future_access::state(ctx->futures.front())->pool();
+    ctx->state = std::make_shared<detail::future_state<result_type> >(pool);
+    auto result = detail::future_access::make(ctx->state);
+    if (ctx->futures.empty()) {
+        ctx->state->set_value(result_type{ static_cast<size_t>(-1), std::vector<future_type>() });
+        return result;
+    }
+
+    // the first callback moves the futures out of the context, so take their states up front
+    std::vector<std::shared_ptr<detail::future_state_base> > states;
+    for (auto& future : ctx->futures) {
+        states.push_back(detail::future_access::state(future));
+    }
+
+    for (size_t i = 0; i < states.size(); ++i) {
+        states[i]->add_callback([ctx, i]() {
+            if (!ctx->done.exchange(true)) {
+                ctx->state->set_value(result_type{ i, std::move(ctx->futures) });
+            }
+        });
+    }
+    return result;
+}
+}
+
+#endif // POOL_FUTURE_H
@@ -0,0 +1,115 @@
+#ifndef STRAND_H
+#define STRAND_H 1
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+#include <dsnutil/dsnutil_cpp_Export.h>
+#include <dsnutil/exception.h>
+#include <dsnutil/task.h>
+#include <dsnutil/threadpool.h>
+
+namespace dsn {
+
+/// \brief Serial executor on top of a \p ThreadPool
+///
+/// Tasks posted to a strand run one after another in submission order, but on any worker of the
+/// pool. Nothing is locked while they run: submitters push onto a lock-free queue and only the
+/// submission that finds the strand empty schedules a drain task on the pool. A drain runs a batch
+/// of tasks and then requeues itself, so a busy strand doesn't monopolize a worker.
+///
+/// A strand only owns a small shared block (pool reference, queue pointers and a counter) and costs
+/// no pool resources while it is empty, so thousands of them can share one pool. Copies of a strand
+/// refer to the same queue.
+///
+/// If the pool discards a drain task without running it (\a overflow_policy::drop_oldest, \a shutdown_now()
+/// or a shutdown deadline) the tasks queued on the strand at that point are discarded as well, so their
+/// futures report \p std::future_errc::broken_promise and the strand accepts new tasks afterwards.
+class dsnutil_cpp_EXPORT strand {
+public:
+    /// \brief Maximum number of tasks a drain runs before it requeues itself
+    static const size_t max_batch = 64;
+
+private:
+    struct node_base {
+        std::atomic<node_base*> next{ nullptr };
+    };
+
+    struct node : node_base {
+        explicit node(dsn::task&& t)
+            : fn(std::move(t))
+        {
+        }
+
+        dsn::task fn;
+    };
+
+    /// \brief Intrusive multi-producer/single-consumer queue (D. Vyukov) plus the strand's state
+    struct state {
+        explicit state(ThreadPool& pool, const task_options& options);
+        ~state();
+
+        void push(node_base* n);
+        node* pop();
+
+        ThreadPool& pool;
+        task_options options;
+        std::atomic<node_base*> head;
+        node_base* tail;
+        node_base stub;
+
+        /// \brief Number of tasks that were pushed but haven't finished yet
+        std::atomic<size_t> count{ 0 };
+    };
+
+    struct drain_task;
+
+    std::shared_ptr<state> m_state;
+
+    void submit(dsn::task&& task);
+    static bool schedule(const std::shared_ptr<state>& s);
+    static void drain(const std::shared_ptr<state>& s);
+    static void discard(const std::shared_ptr<state>& s);
+
+public:
+    explicit strand(ThreadPool& pool, const task_options& options = task_options());
+
+    /// \brief Post a fire-and-forget task to this strand
+    ///
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \note Exceptions escaping \a f terminate the program since there is nobody to report them to.
+    template <class F, class... Args> void post(F&& f, Args&&... args)
+    {
+        submit(dsn::task(detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...)));
+    }
+
+    /// \brief Enqueue a task on this strand
+    ///
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \return \p std::future<> with the result of \a f(args)
+    template <class F, class... Args>
+    auto enqueue(F&& f, Args&&... args) -> std::future<typename detail::call_result<F, Args...>::type>
+    {
+        typedef typename detail::call_result<F, Args...>::type return_type;
+
+        std::packaged_task<return_type()> task(detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> res = task.get_future();
+        submit(dsn::task(std::move(task)));
+        return res;
+    }
+
+    /// \brief Get number of tasks that were submitted but haven't finished yet
+    size_t pending() const { return m_state->count.load(); }
+
+    /// \brief Get the pool this strand runs on
+    ThreadPool& pool() const { return m_state->pool; }
+};
+}
+
+#endif // STRAND_H
@@ -0,0 +1,214 @@
+#ifndef TASK_H
+#define TASK_H 1
+
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <dsnutil/compiler_features.h>
+
+namespace dsn {
+
+namespace detail {
+    /// \brief Compile-time sequence of indices (C++11 stand-in for \p std::index_sequence)
+    template <size_t... I> struct index_sequence {
+    };
+
+    template <size_t N, size_t... I> struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {
+    };
+
+    template <size_t... I> struct make_index_sequence<0, I...> : index_sequence<I...> {
+    };
+
+    /// \brief Callable with bound arguments
+    ///
+    /// Unlike \p std::bind this stores decayed copies of the callable and its arguments and moves
+    /// them into the call, so move-only arguments (e.g. \p std::unique_ptr) can be bound. The call
+    /// operator is meant to be invoked exactly once.
+    template <class F, class... Args> class bound_call {
+        std::tuple<typename std::decay<F>::type, typename std::decay<Args>::type...> m_call;
+
+        template <size_t... I>
+        auto invoke(index_sequence<I...>) -> decltype(std::get<0>(m_call)(std::move(std::get<I + 1>(m_call))...))
+        {
+            return std::get<0>(m_call)(std::move(std::get<I + 1>(m_call))...);
+        }
+
+    public:
+        template <class Fn, class... As>
+        explicit bound_call(Fn&& f, As&&... args)
+            : m_call(std::forward<Fn>(f), std::forward<As>(args)...)
+        {
+        }
+
+        auto operator()() -> decltype(this->invoke(make_index_sequence<sizeof...(Args)>()))
+        {
+            return invoke(make_index_sequence<sizeof...(Args)>());
+        }
+    };
+
+    /// \brief Bind \a args to \a f
+    template <class F, class... Args> bound_call<F, Args...> bind_call(F&& f, Args&&... args)
+    {
+        return bound_call<F, Args...>(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /// \brief Result type of invoking a \p bound_call of \a F and \a Args
+    ///
+    /// Stand-in for \p std::result_of (which is deprecated in C++17 and removed in C++20).
+    template <class F, class... Args> struct call_result {
+        typedef decltype(std::declval<bound_call<F, Args...>&>()()) type;
+    };
+}
+
+/// \brief Move-only type-erased task
+///
+/// This is a replacement for \p std::function<void()> that is tailored for task queues: it only
+/// needs to be movable (so it can hold move-only callables like \p std::packaged_task) and stores
+/// callables of up to \a inline_size bytes inside the object itself, so wrapping a small lambda
+/// doesn't allocate. Larger callables fall back to the heap.
+class task {
+public:
+    /// \brief Size of the inline buffer for callables
+    static const size_t inline_size = 6 * sizeof(void*);
+
+private:
+    /// \brief Type-specific operations on the stored callable
+    struct vtable {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+        bool is_inline;
+    };
+
+    using storage_type = typename std::aligned_storage<inline_size>::type;
+
+    template <class F> struct fits_inline {
+        static const bool value = sizeof(F) <= inline_size && alignof(storage_type) % alignof(F) == 0
+            && std::is_nothrow_move_constructible<F>::value;
+    };
+
+    /// \brief Operations for callables stored in the inline buffer
+    template <class F> struct inline_ops {
+        static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+        static const vtable* table()
+        {
+            static const vtable ops{ &invoke, &move, &destroy, true };
+            return &ops;
+        }
+    };
+
+    /// \brief Operations for heap-allocated callables (the buffer holds a pointer)
+    template <class F> struct heap_ops {
+        static F*& ptr(void* storage) { return *static_cast<F**>(storage); }
+        static void invoke(void* storage) { (*ptr(storage))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) F*(ptr(src));
+            ptr(src) = nullptr;
+        }
+        static void destroy(void* storage) { delete ptr(storage); }
+        static const vtable* table()
+        {
+            static const vtable ops{ &invoke, &move, &destroy, false };
+            return &ops;
+        }
+    };
+
+    storage_type m_storage;
+    const vtable* m_vtable{ nullptr };
+
+    template <class F> void construct(F&& f, std::true_type)
+    {
+        using type = typename std::decay<F>::type;
+        new (&m_storage) type(std::forward<F>(f));
+        m_vtable = inline_ops<type>::table();
+    }
+
+    template <class F> void construct(F&& f, std::false_type)
+    {
+        using type = typename std::decay<F>::type;
+        new (&m_storage) type*(new type(std::forward<F>(f)));
+        m_vtable = heap_ops<type>::table();
+    }
+
+public:
+    task() dsnutil_cpp_NOEXCEPT {}
+    task(std::nullptr_t) dsnutil_cpp_NOEXCEPT {}
+
+    /// \brief Wrap a callable
+    ///
+    /// \param f Callable taking no arguments; its return value (if any) is discarded
+    template <class F,
+        class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, task>::value
+            && !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+    task(F&& f)
+    {
+        construct(std::forward<F>(f), std::integral_constant<bool, fits_inline<typename std::decay<F>::type>::value>());
+    }
+
+    task(task&& other) dsnutil_cpp_NOEXCEPT : m_vtable(other.m_vtable)
+    {
+        if (m_vtable) {
+            m_vtable->move(&m_storage, &other.m_storage);
+            other.m_vtable = nullptr;
+        }
+    }
+
+    task& operator=(task&& other) dsnutil_cpp_NOEXCEPT
+    {
+        if (this != &other) {
+            reset();
+            if (other.m_vtable) {
+                other.m_vtable->move(&m_storage, &other.m_storage);
+                m_vtable = other.m_vtable;
+                other.m_vtable = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    task& operator=(std::nullptr_t) dsnutil_cpp_NOEXCEPT
+    {
+        reset();
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() { reset(); }
+
+    /// \brief Destroy the stored callable (if any)
+    void reset() dsnutil_cpp_NOEXCEPT
+    {
+        if (m_vtable) {
+            m_vtable->destroy(&m_storage);
+            m_vtable = nullptr;
+        }
+    }
+
+    /// \brief Check whether a callable is stored
+    explicit operator bool() const dsnutil_cpp_NOEXCEPT { return m_vtable != nullptr; }
+
+    /// \brief Check whether the stored callable lives in the inline buffer
+    ///
+    /// \return true if the callable was stored without a heap allocation
+    bool is_inline() const dsnutil_cpp_NOEXCEPT { return m_vtable != nullptr && m_vtable->is_inline; }
+
+    /// \brief Invoke the stored callable
+    ///
+    /// \warning Calling an empty task is undefined behaviour
+    void operator()() { m_vtable->invoke(&m_storage); }
+};
+}
+
+#endif // TASK_H
@@ -0,0 +1,140 @@
+#ifndef TASK_GROUP_H
+#define TASK_GROUP_H 1
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <type_traits>
+
+#include <dsnutil/chrono/clock_type.hpp>
+#include <dsnutil/compiler_features.h>
+#include <dsnutil/dsnutil_cpp_Export.h>
+#include <dsnutil/threadpool.h>
+
+namespace dsn {
+
+/// \brief Set of tasks on a \p ThreadPool that can be waited for as a whole
+///
+/// Tasks started with \a run() are counted by a single atomic instead of one \p std::future per task.
+/// When \a wait() is called from a worker of the same pool it executes queued tasks until the group is
+/// done instead of blocking, so nested fork/join inside the pool can't starve it of workers.
+///
+/// The destructor waits for all tasks of the group (without rethrowing their exceptions).
+class dsnutil_cpp_EXPORT task_group {
+    /// \brief Wrapper that marks its task as finished after running it
+    ///
+    /// A task that is discarded by the pool without running (e.g. by \a overflow_policy::drop_oldest)
+    /// is marked as finished as well so waiters don't hang.
+    template <class F> class call {
+        task_group* m_group;
+        F m_f;
+
+    public:
+        call(task_group* group, F&& f)
+            : m_group(group)
+            , m_f(std::move(f))
+        {
+        }
+
+        call(call&& other) dsnutil_cpp_NOEXCEPT_EXPR(std::is_nothrow_move_constructible<F>::value)
+            : m_group(other.m_group)
+            , m_f(std::move(other.m_f))
+        {
+            other.m_group = nullptr;
+        }
+
+        ~call()
+        {
+            if (m_group) {
+                m_group->finish();
+            }
+        }
+
+        void operator()()
+        {
+            try {
+                m_f();
+            } catch (...) {
+                m_group->set_exception(std::current_exception());
+            }
+            task_group* group = m_group;
+            m_group = nullptr;
+            group->finish();
+        }
+    };
+
+    ThreadPool& m_pool;
+
+    /// \brief Number of tasks that haven't finished yet
+    std::atomic<size_t> m_pending{ 0 };
+
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+
+    /// \brief First exception thrown by a task of this group
+    std::exception_ptr m_exception;
+
+    void finish();
+    void set_exception(std::exception_ptr exception);
+    bool wait_until(const dsn::chrono::clock_type::time_point* deadline);
+    void rethrow();
+
+public:
+    explicit task_group(ThreadPool& pool);
+    ~task_group();
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    /// \brief Run a task as part of this group
+    ///
+    /// \param options Scheduling options for the task
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    template <class F, class... Args> void run(const task_options& options, F&& f, Args&&... args)
+    {
+        auto bound = detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...);
+        m_pending++;
+        // if post() throws the wrapper (or the task it was moved into) marks the task as finished on destruction
+        m_pool.post(options, call<decltype(bound)>(this, std::move(bound)));
+    }
+
+    /// \brief Run a task as part of this group
+    ///
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    template <class F, class... Args, class = typename detail::disable_if_task_options<F>::type>
+    void run(F&& f, Args&&... args)
+    {
+        run(task_options(), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    void wait();
+
+    /// \brief Wait for all tasks of this group with a timeout
+    ///
+    /// \see wait
+    ///
+    /// \param timeout Maximum time to wait (e.g. a \p dsn::chrono::duration)
+    ///
+    /// \return true if all tasks finished, false if the timeout expired first
+    ///
+    /// \throw Rethrows the first exception thrown by a task of this group once all of them finished
+    template <class Rep, class Period> bool wait_for(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        auto deadline = dsn::chrono::clock_type::now()
+            + std::chrono::duration_cast<dsn::chrono::clock_type::duration>(timeout);
+        if (!wait_until(&deadline)) {
+            return false;
+        }
+        rethrow();
+        return true;
+    }
+
+    /// \brief Get number of tasks of this group that haven't finished yet
+    size_t pending() const { return m_pending; }
+};
+}
+
+#endif // TASK_GROUP_H
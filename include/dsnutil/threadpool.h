@@ -1,25 +1,404 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H 1
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <future>
+#include <iterator>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 
+#include <dsnutil/cancellation.h>
+#include <dsnutil/chrono/clock_type.hpp>
 #include <dsnutil/dsnutil_cpp_Export.h>
 #include <dsnutil/exception.h>
+#include <dsnutil/task.h>
 
 namespace dsn {
 
-/// \brief Fixed size thread pool
+struct task_options;
+
+namespace detail {
+    /// \brief SFINAE helper to keep generic \p ThreadPool overloads from swallowing \p task_options
+    template <class F>
+    struct disable_if_task_options : std::enable_if<!std::is_same<typename std::decay<F>::type, task_options>::value> {
+    };
+
+    /// \brief Task that throws \p dsn::task_cancelled instead of running once its token is cancelled
+    template <class F> class cancellable_call {
+        cancellation_token m_token;
+        F m_f;
+
+    public:
+        cancellable_call(const cancellation_token& token, F&& f)
+            : m_token(token)
+            , m_f(std::move(f))
+        {
+        }
+
+        auto operator()() -> decltype(m_f())
+        {
+            m_token.throw_if_cancelled();
+            return m_f();
+        }
+    };
+
+    /// \brief Whether \p F completes itself as cancelled when run after its token was cancelled
+    ///
+    /// \p ThreadPool doesn't wrap such tasks into a \p skippable_call.
+    template <class F> struct checks_token : std::false_type {
+    };
+
+    template <class F> struct checks_token<bound_call<F> > : checks_token<F> {
+    };
+
+    /// \brief Fire-and-forget task that is skipped once its token is cancelled
+    template <class F> class skippable_call {
+        cancellation_token m_token;
+        F m_f;
+
+    public:
+        skippable_call(const cancellation_token& token, F&& f)
+            : m_token(token)
+            , m_f(std::move(f))
+        {
+        }
+
+        void operator()()
+        {
+            if (!m_token.is_cancelled()) {
+                m_f();
+            }
+        }
+    };
+}
+
+/// \brief Dequeue order across \p ThreadPool priority levels
+enum class priority_policy {
+    /// \brief Always serve the highest non-empty level first
+    strict,
+
+    /// \brief Serve levels in rounds where each level may run up to its weight in tasks
+    ///
+    /// Higher levels still go first within a round, so lower ones can delay them by at most one
+    /// round but cannot starve them (and vice versa).
+    weighted_fair
+};
+
+/// \brief Behaviour of a bounded \p ThreadPool when its shared queue is full
+enum class overflow_policy {
+    /// \brief Block the submitting thread until a worker makes room
+    block,
+
+    /// \brief Refuse the task (\p enqueue()/\p post() throw a \p dsn::Exception)
+    reject,
+
+    /// \brief Run the task synchronously on the submitting thread
+    caller_runs,
+
+    /// \brief Discard the oldest queued task of the lowest non-empty priority level
+    ///
+    /// The \p std::future of a discarded task reports \p std::future_errc::broken_promise.
+    drop_oldest
+};
+
+/// \brief How idle \p ThreadPool workers wait for new tasks
+enum class wait_strategy {
+    /// \brief Block on a condition variable right away
+    block,
+
+    /// \brief Spin for \p thread_pool_options::spin_count iterations, then block
+    spin,
+
+    /// \brief Spin, then yield the CPU \p thread_pool_options::yield_count times, then block
+    spin_yield,
+
+    /// \brief Never block (only sensible with workers pinned to dedicated cores)
+    busy_poll
+};
+
+/// \brief Data structure of the shared \p ThreadPool queue
+enum class queue_policy {
+    /// \brief Mutex-protected queues (supports every pool feature)
+    locked,
+
+    /// \brief Bounded lock-free multi-producer/multi-consumer ring in front of the locked queues
+    ///
+    /// Submitting and dequeuing don't take the pool's mutex unless the ring is full (then tasks
+    /// overflow into the locked queues) or a worker has to be woken up. Only used by pools with a single
+    /// priority level, an unbounded queue and a fixed size; other pools fall back to \a locked.
+    /// NUMA node hints are ignored for tasks in the ring.
+    lock_free
+};
+
+/// \brief Construction parameters for \p ThreadPool
+///
+/// Collects all tunables of a \p ThreadPool so that new settings can be added without growing
+/// the constructor's argument list.
+struct dsnutil_cpp_EXPORT thread_pool_options {
+    /// \brief Number of worker threads
+    ///
+    /// For elastic pools this is the initial and minimum number of workers.
+    size_t num_threads{ std::thread::hardware_concurrency() };
+
+    /// \brief Maximum number of worker threads
+    ///
+    /// Setting this above \a num_threads makes the pool elastic: whenever a task is submitted while no
+    /// worker is waiting for work and the head of the shared queue has been waiting for at least
+    /// \a grow_threshold an additional worker is started. Workers above \a num_threads exit after
+    /// being idle for \a keep_alive. Values below \a num_threads result in a fixed size pool.
+    size_t max_threads{ 0 };
+
+    /// \brief Queue wait time after which an elastic pool adds a worker
+    dsn::chrono::clock_type::duration grow_threshold{ std::chrono::milliseconds(1) };
+
+    /// \brief Idle time after which surplus workers of an elastic pool exit
+    dsn::chrono::clock_type::duration keep_alive{ std::chrono::seconds(30) };
+
+    /// \brief Maximum number of compensating workers for \p ThreadPool::blocking() regions (0 = none)
+    ///
+    /// While a worker is inside a blocking region the pool runs an extra worker in its place, so the
+    /// number of workers that can actually use a CPU stays at the pool's size. Compensating workers exit
+    /// as soon as the region they stand in for ends (after finishing their current task).
+    size_t max_compensating{ 0 };
+
+    /// \brief Enable work-stealing scheduler
+    ///
+    /// When enabled each worker owns a local task deque. Tasks enqueued from inside a worker are
+    /// pushed onto that worker's deque (and popped LIFO by it) while idle workers steal the oldest
+    /// tasks from their siblings. Tasks enqueued from outside the pool still go through the shared
+    /// queue.
+    bool work_stealing{ false };
+
+    /// \brief Number of priority levels
+    ///
+    /// Level 0 is the highest priority and used by default, higher levels are served after it.
+    size_t priority_levels{ 1 };
+
+    /// \brief How workers pick tasks from different priority levels
+    priority_policy priority_mode{ priority_policy::strict };
+
+    /// \brief Per-level weights for \a priority_policy::weighted_fair
+    ///
+    /// If this doesn't contain exactly \a priority_levels entries level \p i gets a weight of
+    /// \p priority_levels - \p i.
+    std::vector<unsigned> priority_weights;
+
+    /// \brief Maximum number of tasks in the shared queues (0 = unbounded)
+    ///
+    /// Tasks that workers push onto their own deque in work-stealing mode don't count against the
+    /// capacity.
+    size_t queue_capacity{ 0 };
+
+    /// \brief What to do with new tasks while the shared queues hold \a queue_capacity tasks
+    overflow_policy overflow{ overflow_policy::block };
+
+    /// \brief CPUs to pin the workers to
+    ///
+    /// Worker \p i is pinned to \p cpu_affinity[i % cpu_affinity.size()]. Leave empty to let the OS
+    /// place the workers (or to pin them per node with \a numa_aware).
+    ///
+    /// \note Pinning is supported on Linux and Windows and silently ignored elsewhere.
+    std::vector<unsigned> cpu_affinity;
+
+    /// \brief Enable NUMA-aware worker placement
+    ///
+    /// Workers are assigned to the NUMA nodes reported by \p numa_topology() (round-robin, or by the node
+    /// of their CPU if \a cpu_affinity is set) and pinned to that node's CPUs. Every node gets its own
+    /// set of shared queues which its workers serve before helping out other nodes.
+    bool numa_aware{ false };
+
+    /// \brief How idle workers wait for new tasks
+    ///
+    /// While at least one worker is spinning, submitters skip waking up blocked workers; a spinning
+    /// worker that finds more than one task waiting wakes up another worker itself.
+    wait_strategy idle_strategy{ wait_strategy::block };
+
+    /// \brief Number of busy-wait iterations for \a wait_strategy::spin and \a wait_strategy::spin_yield
+    unsigned spin_count{ 4000 };
+
+    /// \brief Number of \p std::this_thread::yield() calls for \a wait_strategy::spin_yield
+    unsigned yield_count{ 64 };
+
+    /// \brief Data structure of the shared queue
+    queue_policy queue_mode{ queue_policy::locked };
+
+    /// \brief Number of slots in the ring of \a queue_policy::lock_free (rounded up to a power of two)
+    size_t ring_capacity{ 4096 };
+
+    /// \brief Collect metrics from the start (see \p ThreadPool::enable_metrics())
+    bool metrics{ false };
+
+    /// \brief Called by every worker thread before it processes its first task
+    ///
+    /// Receives the worker's index (see \p ThreadPool::worker_index()). Elastic pools call it again
+    /// whenever a worker is started in a free slot.
+    std::function<void(size_t)> on_worker_start;
+
+    /// \brief Called by every worker thread right before it exits
+    ///
+    /// The worker's context (see \p ThreadPool::set_worker_context()) is still available and is released
+    /// right after this returns.
+    std::function<void(size_t)> on_worker_stop;
+};
+
+/// \brief Snapshot of \p ThreadPool metrics
+///
+/// Durations are sorted into logarithmic histograms: bucket \a i counts durations of at least
+/// \a bucket_floor(i) and less than \a bucket_floor(i + 1); the last bucket also counts all longer ones.
+struct dsnutil_cpp_EXPORT thread_pool_metrics {
+    static const size_t histogram_buckets = 32;
+    typedef std::array<unsigned long long, histogram_buckets> histogram;
+
+    /// \brief Lower bound of a histogram bucket (2^i nanoseconds, zero for the first bucket)
+    static dsn::chrono::clock_type::duration bucket_floor(size_t bucket)
+    {
+        return std::chrono::duration_cast<dsn::chrono::clock_type::duration>(
+            std::chrono::nanoseconds(bucket == 0 ? 0 : 1ull << bucket));
+    }
+
+    /// \brief Number of tasks that are queued but haven't started yet
+    size_t queue_depth{ 0 };
+
+    /// \brief Highest \a queue_depth observed
+    size_t peak_queue_depth{ 0 };
+
+    /// \brief Number of submitted tasks
+    unsigned long long submitted{ 0 };
+
+    /// \brief Number of finished tasks
+    unsigned long long completed{ 0 };
+
+    /// \brief Time between submission and start of the tasks
+    histogram queue_wait = histogram();
+
+    /// \brief Time the tasks took to run
+    histogram execution_time = histogram();
+
+    /// \brief Fraction of time each worker slot spent running tasks
+    std::vector<double> busy_ratio;
+};
+
+/// \brief Per-submission parameters for \p ThreadPool tasks
+struct dsnutil_cpp_EXPORT task_options {
+    task_options() = default;
+
+    /// \brief Initialize options with a priority level
+    ///
+    /// \param level Priority level for the task (0 = highest)
+    explicit task_options(unsigned level)
+        : priority(level)
+    {
+    }
+
+    /// \brief Priority level of the task (0 = highest)
+    ///
+    /// Levels beyond the pool's \a thread_pool_options::priority_levels are clamped to the lowest one.
+    unsigned priority{ 0 };
+
+    /// \brief NUMA node whose workers should run the task
+    ///
+    /// Negative values leave the choice to the pool: tasks submitted by a worker stay on its node,
+    /// others are spread across the nodes round-robin. Nodes beyond \p ThreadPool::num_nodes() wrap
+    /// around. This is only a hint; idle workers of other nodes still pick up the task.
+    int node{ -1 };
+
+    /// \brief Token to cancel the task while it is still queued
+    ///
+    /// A task whose token is cancelled before it starts is dropped without running; its future (if
+    /// any) gets a \p dsn::task_cancelled exception right when the token is cancelled, and the task no
+    /// longer counts toward the queue capacity. Running tasks can poll the token themselves.
+    cancellation_token token;
+};
+
+class ThreadPool;
+
+/// \brief Awaitable that resumes a coroutine on a \p ThreadPool worker
+///
+/// Returned by \p ThreadPool::schedule(). The suspended coroutine's handle is posted to the pool as a
+/// regular task; it fits into \p dsn::task's inline buffer, so resuming doesn't allocate. This type
+/// doesn't depend on \p <coroutine> itself; see \p dsnutil/threadpool_coroutine.h for coroutine types.
+///
+/// If the pool refuses the resumption (stopped pool, full queue with \a overflow_policy::reject) or
+/// discards it later (\a overflow_policy::drop_oldest, \a ThreadPool::shutdown_now() or a shutdown deadline)
+/// the coroutine is resumed on the thread that dropped it and \p co_await throws a \p dsn::Exception.
+class schedule_operation {
+    /// \brief Task that resumes the coroutine, or resumes it with an error if it is destroyed unrun
+    template <class Handle> class resumption {
+        Handle m_handle;
+        schedule_operation* m_operation;
+
+    public:
+        resumption(Handle handle, schedule_operation* operation)
+            : m_handle(handle)
+            , m_operation(operation)
+        {
+        }
+
+        resumption(resumption&& other) dsnutil_cpp_NOEXCEPT
+            : m_handle(other.m_handle)
+            , m_operation(other.m_operation)
+        {
+            other.m_operation = nullptr;
+        }
+
+        ~resumption()
+        {
+            if (m_operation) {
+                m_operation->m_dropped = true;
+                m_handle.resume();
+            }
+        }
+
+        void operator()()
+        {
+            m_operation = nullptr;
+            m_handle.resume();
+        }
+    };
+
+    ThreadPool& m_pool;
+    task_options m_options;
+
+    /// \brief Set when the pool dropped the resumption task
+    bool m_dropped{ false };
+
+public:
+    schedule_operation(ThreadPool& pool, const task_options& options)
+        : m_pool(pool)
+        , m_options(options)
+    {
+        // cancellation is left to the coroutine itself, which can poll the token after resuming
+        m_options.token = cancellation_token();
+    }
+
+    bool await_ready() const dsnutil_cpp_NOEXCEPT { return false; }
+
+    template <class Handle> void await_suspend(Handle handle);
+
+    void await_resume() const
+    {
+        if (m_dropped) {
+            DSN_DEFAULT_EXCEPTION_SIMPLE("ThreadPool dropped the coroutine's resumption!");
+        }
+    }
+};
+
+/// \brief Get the NUMA topology of this machine
+///
+/// \return CPU indices for each NUMA node; a single node with all CPUs if the topology can't be
+/// determined
+dsnutil_cpp_EXPORT std::vector<std::vector<unsigned> > numa_topology();
+
+/// \brief Thread pool
 ///
 /// This can be used to quickly implement thread pool of fixed size where arbitrary tasks
-/// can be enqueued and executed in parallel.
+/// can be enqueued and executed in parallel. Optionally the pool can grow and shrink between
+/// a minimum and maximum size depending on its load (see \p thread_pool_options::max_threads).
 ///
 /// The pool is designed so that it can take an arbitrary number of tasks but only executes
 /// a given number of them in parallel.
@@ -28,50 +407,476 @@ namespace dsn {
 class dsnutil_cpp_EXPORT ThreadPool {
 public:
     ThreadPool(size_t size = std::thread::hardware_concurrency());
+    explicit ThreadPool(const thread_pool_options& options);
     ~ThreadPool();
 
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
     /// \brief Enqueue a task on this thread pool
     ///
-    /// Queues a task for execution in the thread pool. The task will appended to \p tasks and executed by
-    /// one of the threads in \p workers at some point in the future.
+    /// Queues a task for execution in the thread pool. The task will appended to the pool's queue and executed
+    /// by one of the threads in \p workers at some point in the future.
+    ///
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \return \p std::future<> with the result of \a f(args)
+    template <class F, class... Args, class = typename detail::disable_if_task_options<F>::type>
+    auto enqueue(F&& f, Args&&... args) -> std::future<typename detail::call_result<F, Args...>::type>
+    {
+        return enqueue(task_options(), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /// \brief Enqueue a task with explicit submission options
     ///
+    /// \param options Per-task parameters like the priority level
     /// \param f Function that shall be executed in the thread pool (this can be anything callable)
-    /// \param args Variable arguments to \a f
+    /// \param args Variable arguments to \a f (may be move-only)
     ///
     /// \return \p std::future<> with the result of \a f(args)
     template <class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>
+    auto enqueue(const task_options& options, F&& f, Args&&... args)
+        -> std::future<typename detail::call_result<F, Args...>::type>
     {
-        typedef typename std::result_of<F(Args...)>::type return_type;
+        typedef typename detail::call_result<F, Args...>::type return_type;
 
         if (m_stop)
             DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot enqueue tasks on stopped ThreadPool!");
 
-        auto task = std::make_shared<std::packaged_task<return_type()> >(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        auto task = package<return_type>(options, detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> res = task.get_future();
+        push(dsn::task(std::move(task)), options, false);
+        return res;
+    }
 
-        std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            tasks.push([task]() { (*task)(); });
+    /// \brief Enqueue a task unless the pool's queue is full
+    ///
+    /// Never blocks and never runs \a f on the calling thread, regardless of the pool's
+    /// \a thread_pool_options::overflow policy.
+    ///
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \return \p std::future<> with the result of \a f(args) or an invalid future if the queue was full
+    template <class F, class... Args, class = typename detail::disable_if_task_options<F>::type>
+    auto try_enqueue(F&& f, Args&&... args) -> std::future<typename detail::call_result<F, Args...>::type>
+    {
+        return try_enqueue(task_options(), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /// \brief Enqueue a task with explicit submission options unless the pool's queue is full
+    ///
+    /// \see try_enqueue
+    template <class F, class... Args>
+    auto try_enqueue(const task_options& options, F&& f, Args&&... args)
+        -> std::future<typename detail::call_result<F, Args...>::type>
+    {
+        typedef typename detail::call_result<F, Args...>::type return_type;
+
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot enqueue tasks on stopped ThreadPool!");
+
+        auto task = package<return_type>(options, detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> res = task.get_future();
+        if (!push(dsn::task(std::move(task)), options, true)) {
+            return std::future<return_type>();
         }
-        condition.notify_one();
         return res;
     }
 
+    /// \brief Post a fire-and-forget task on this thread pool
+    ///
+    /// Works like \a enqueue() but doesn't create a \p std::future for the result. If \a f and \a args
+    /// fit into \p dsn::task's inline buffer submitting the task doesn't allocate at all.
+    ///
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \note Exceptions escaping \a f terminate the program since there is nobody to report them to.
+    template <class F, class... Args, class = typename detail::disable_if_task_options<F>::type>
+    void post(F&& f, Args&&... args)
+    {
+        post(task_options(), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /// \brief Post a fire-and-forget task with explicit submission options
+    ///
+    /// \param options Per-task parameters like the priority level
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    template <class F, class... Args> void post(const task_options& options, F&& f, Args&&... args)
+    {
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot post tasks on stopped ThreadPool!");
+
+        push(wrap(options, detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...)), options, false);
+    }
+
+    /// \brief Post a fire-and-forget task unless the pool's queue is full
+    ///
+    /// \see try_enqueue
+    ///
+    /// \return true if the task was queued
+    template <class F, class... Args, class = typename detail::disable_if_task_options<F>::type>
+    bool try_post(F&& f, Args&&... args)
+    {
+        return try_post(task_options(), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /// \brief Post a fire-and-forget task with explicit submission options unless the pool's queue is full
+    ///
+    /// \see try_enqueue
+    ///
+    /// \return true if the task was queued
+    template <class F, class... Args> bool try_post(const task_options& options, F&& f, Args&&... args)
+    {
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot post tasks on stopped ThreadPool!");
+
+        return push(wrap(options, detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...)), options, true);
+    }
+
+    /// \brief Enqueue a batch of tasks on this thread pool
+    ///
+    /// Works like calling \a enqueue() for every element in [\a first, \a last) but takes the queue lock
+    /// only once and wakes up at most as many sleeping workers as there are new tasks.
+    ///
+    /// \note With the \a overflow_policy::reject policy the tasks that still fit are queued before the
+    /// exception is thrown.
+    ///
+    /// \param first Iterator to the first callable (use \p std::make_move_iterator() for move-only ones)
+    /// \param last Iterator past the last callable
+    /// \param options Per-task parameters applied to every task of the batch
+    ///
+    /// \return \p std::future<> for each task, in the same order as the input range
+    template <class InputIt>
+    auto enqueue_bulk(InputIt first, InputIt last, const task_options& options = task_options())
+        -> std::vector<std::future<typename detail::call_result<typename std::iterator_traits<InputIt>::value_type>::type> >
+    {
+        typedef typename detail::call_result<typename std::iterator_traits<InputIt>::value_type>::type return_type;
+
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot enqueue tasks on stopped ThreadPool!");
+
+        std::vector<std::future<return_type> > res;
+        std::vector<dsn::task> batch;
+        for (; first != last; ++first) {
+            auto task = package<return_type>(options, *first);
+            res.push_back(task.get_future());
+            batch.emplace_back(std::move(task));
+        }
+        push_bulk(batch.data(), batch.size(), options);
+        return res;
+    }
+
+    /// \brief Post a batch of fire-and-forget tasks on this thread pool
+    ///
+    /// Bulk variant of \a post(); see \a enqueue_bulk() for details.
+    ///
+    /// \param first Iterator to the first callable (use \p std::make_move_iterator() for move-only ones)
+    /// \param last Iterator past the last callable
+    /// \param options Per-task parameters applied to every task of the batch
+    template <class InputIt> void post_bulk(InputIt first, InputIt last, const task_options& options = task_options())
+    {
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot post tasks on stopped ThreadPool!");
+
+        std::vector<dsn::task> batch;
+        for (; first != last; ++first) {
+            batch.push_back(wrap(options, *first));
+        }
+        push_bulk(batch.data(), batch.size(), options);
+    }
+
+    /// \brief Identifier of a timer created by \a schedule_at(), \a schedule_after() or \a schedule_every()
+    typedef unsigned long long timer_id;
+
+    /// \brief Run a task at a given point in time
+    ///
+    /// The task is queued on the pool once \a when has passed. All timers of a pool share a single
+    /// thread that is started on first use. That thread never blocks on a full bounded queue or runs
+    /// tasks itself, whatever the \a thread_pool_options::overflow policy: if the queue is full the task
+    /// is retried shortly after.
+    ///
+    /// \param when Time at which the task shall be queued (e.g. a \p dsn::chrono::time_point)
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \return Identifier that can be passed to \a cancel_timer()
+    template <class F, class... Args>
+    timer_id schedule_at(dsn::chrono::clock_type::time_point when, F&& f, Args&&... args)
+    {
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot schedule tasks on stopped ThreadPool!");
+
+        return add_timer(when, dsn::chrono::clock_type::duration::zero(),
+            dsn::task(detail::bind_call(std::forward<F>(f), std::forward<Args>(args)...)), nullptr);
+    }
+
+    /// \brief Run a task after a delay
+    ///
+    /// \see schedule_at
+    ///
+    /// \param delay Time after which the task shall be queued (e.g. a \p dsn::chrono::duration)
+    /// \param f Function that shall be executed in the thread pool (this can be anything callable)
+    /// \param args Variable arguments to \a f (may be move-only)
+    ///
+    /// \return Identifier that can be passed to \a cancel_timer()
+    template <class F, class... Args>
+    timer_id schedule_after(dsn::chrono::clock_type::duration delay, F&& f, Args&&... args)
+    {
+        return schedule_at(dsn::chrono::clock_type::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /// \brief Run a task periodically
+    ///
+    /// Queues \a f every \a period, starting one \a period from now, until the timer is cancelled or the
+    /// pool is stopped. If the pool falls behind by more than a period the missed runs are skipped
+    /// instead of being queued in a burst, and so is a run that finds a bounded queue full (regardless
+    /// of the \a thread_pool_options::overflow policy). Runs can overlap if \a f takes longer than
+    /// \a period.
+    ///
+    /// \param period Interval between two runs (e.g. a \p dsn::chrono::duration)
+    /// \param f Function that shall be executed in the thread pool (must be copyable)
+    ///
+    /// \return Identifier that can be passed to \a cancel_timer()
+    template <class F> timer_id schedule_every(dsn::chrono::clock_type::duration period, F&& f)
+    {
+        if (m_stop)
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot schedule tasks on stopped ThreadPool!");
+        if (period <= dsn::chrono::clock_type::duration::zero())
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Period of a recurring task must be positive!");
+
+        return add_timer(dsn::chrono::clock_type::now() + period, period, dsn::task(),
+            std::make_shared<std::function<void()> >(std::forward<F>(f)));
+    }
+
+    bool cancel_timer(timer_id id);
+    size_t pending_timers() const;
+
+    /// \brief Move the awaiting coroutine onto a worker of this pool
+    ///
+    /// Use as \p co_await \p pool.schedule(); the coroutine continues on a worker once the task is dequeued.
+    ///
+    /// \param options Per-task parameters for the resumption (e.g. priority level or NUMA node)
+    schedule_operation schedule(const task_options& options = task_options())
+    {
+        return schedule_operation(*this, options);
+    }
+
+    /// \brief Scope in which a worker waits for something other than the CPU
+    ///
+    /// Returned by \a blocking(); the region ends when this object is destroyed.
+    class blocking_region {
+        friend class ThreadPool;
+        ThreadPool* m_pool;
+
+        explicit blocking_region(ThreadPool* pool)
+            : m_pool(pool)
+        {
+        }
+
+    public:
+        blocking_region(blocking_region&& other) dsnutil_cpp_NOEXCEPT : m_pool(other.m_pool)
+        {
+            other.m_pool = nullptr;
+        }
+
+        blocking_region(const blocking_region&) = delete;
+        blocking_region& operator=(const blocking_region&) = delete;
+        blocking_region& operator=(blocking_region&&) = delete;
+
+        ~blocking_region()
+        {
+            if (m_pool) {
+                m_pool->end_blocking();
+            }
+        }
+    };
+
+    blocking_region blocking();
+
     void stop();
+    size_t shutdown(dsn::chrono::clock_type::time_point deadline);
+    std::vector<dsn::task> shutdown_now();
 
     size_t num_workers() const;
+    size_t min_workers() const;
+    size_t max_workers() const;
+    size_t worker_slots() const;
 
     bool idle() const;
     size_t idle_count() const;
 
+    bool is_worker_thread() const;
+
+    /// \brief Value of \a worker_index() on threads that aren't workers of this pool
+    static const size_t no_worker = static_cast<size_t>(-1);
+
+    size_t worker_index() const;
+    void set_worker_context(std::shared_ptr<void> context);
+
+    /// \brief Get the context of the calling worker
+    ///
+    /// \return Pointer set with \a set_worker_context() or \p nullptr if there is none or the calling
+    ///     thread isn't a worker of this pool
+    template <class T> T* worker_context() const { return static_cast<T*>(current_context()); }
+    bool run_pending_task();
+
+    size_t num_nodes() const;
+    size_t num_workers(size_t node) const;
+    size_t idle_count(size_t node) const;
+
+    bool work_stealing() const;
+
+    size_t priority_levels() const;
+    size_t queue_depth(size_t level) const;
+
+    size_t queue_capacity() const;
+    queue_policy queue_mode() const;
+
+    static bool metrics_supported();
+    bool enable_metrics(bool enable);
+    bool metrics_enabled() const;
+    thread_pool_metrics metrics() const;
+    void reset_metrics();
+
 private:
-    /// \brief Currently active worker threads to execute tasks
+    struct worker_queue;
+    struct lane;
+    struct node;
+    struct timer_queue;
+    struct metrics_state;
+    struct injection_queue;
+    struct timed_task;
+    struct cancel_slot;
+    class cancellable_task;
+
+    /// \brief Outcome of trying to put a task into a bounded shared queue
+    enum class admission { queued, rejected, caller_runs, stopped };
+
+    /// \brief Wrap \a f into a \p std::packaged_task that honours the cancellation token in \a options
+    template <class R, class F> static std::packaged_task<R()> package(const task_options& options, F&& f)
+    {
+        typedef typename std::decay<F>::type function_type;
+        if (options.token.can_be_cancelled()) {
+            return std::packaged_task<R()>(
+                detail::cancellable_call<function_type>(options.token, function_type(std::forward<F>(f))));
+        }
+        return std::packaged_task<R()>(std::forward<F>(f));
+    }
+
+    /// \brief Wrap \a f into a \p dsn::task that honours the cancellation token in \a options
+    template <class F> static dsn::task wrap(const task_options& options, F&& f)
+    {
+        typedef typename std::decay<F>::type function_type;
+        if (options.token.can_be_cancelled() && !detail::checks_token<function_type>::value) {
+            return dsn::task(detail::skippable_call<function_type>(options.token, function_type(std::forward<F>(f))));
+        }
+        return dsn::task(std::forward<F>(f));
+    }
+
+    dsn::task guard(dsn::task&& task, const cancellation_token& token, std::shared_ptr<cancel_slot>& slot);
+    bool push(dsn::task&& task, const task_options& options, bool may_fail);
+    size_t queued_load() const;
+    admission admit(std::unique_lock<std::mutex>& lock, lane& target, dsn::task& task, bool may_fail,
+        std::vector<dsn::task>& evicted);
+    void push_bulk(dsn::task* tasks, size_t count, const task_options& options);
+    bool pop_lane(size_t node, dsn::task& task);
+    size_t node_for(const task_options& options);
+    lane& lane_for(size_t node, const task_options& options);
+    void spawn_worker(size_t index);
+    void maybe_grow();
+    void arm_growth_check();
+    void check_growth();
+    void worker_main(size_t index);
+    void worker_loop(size_t index);
+    void end_blocking();
+    void begin_stop(bool abort);
+    void join_workers();
+    std::vector<dsn::task> take_queued();
+    void* current_context() const;
+    bool try_pop(size_t index, dsn::task& task);
+    bool try_steal(size_t index, dsn::task& task);
+    void notify_one();
+    void notify(size_t count);
+    bool spin_wait();
+    timer_id add_timer(dsn::chrono::clock_type::time_point when, dsn::chrono::clock_type::duration period,
+        dsn::task&& once, std::shared_ptr<std::function<void()> > repeat);
+    void timer_main();
+    bool metrics_on() const;
+    dsn::task timed(dsn::task&& task);
+    void note_depth();
+
+    /// \brief Worker thread slots (threads of retired workers stay here until their slot is reused)
     std::vector<std::thread> workers;
 
-    /// \brief Tasks queued on the pool
-    std::queue<std::function<void()> > tasks;
+    /// \brief Threads of retired workers whose slots were reused (protected by \a queue_mutex)
+    ///
+    /// They are joined by the thread that reused the slot once it has released \a queue_mutex.
+    std::vector<std::thread> m_retired;
+
+    /// \brief Flags for the slots in \a workers which run a live worker (protected by \a queue_mutex)
+    std::vector<bool> m_active_slots;
+
+    /// \brief Number of live workers
+    std::atomic<size_t> m_num_workers{ 0 };
+
+    /// \brief Minimum number of workers for elastic pools
+    size_t m_min_workers{ 0 };
+
+    /// \brief Number of regular worker slots (the slots above are reserved for compensating workers)
+    size_t m_elastic_slots{ 0 };
+
+    /// \brief Number of workers inside a \a blocking() region (modified under \a queue_mutex)
+    std::atomic<size_t> m_blocking{ 0 };
+
+    /// \brief Number of live compensating workers (modified under \a queue_mutex)
+    std::atomic<size_t> m_compensating{ 0 };
+
+    /// \brief Number of workers that are exiting but still run their stop hook (protected by \a queue_mutex)
+    ///
+    /// They keep their slot and are still included in \a m_num_workers until they're done.
+    size_t m_retiring{ 0 };
+
+    /// \brief Queue wait time after which an elastic pool adds a worker
+    dsn::chrono::clock_type::duration m_grow_threshold;
+
+    /// \brief Whether the timer thread has a growth check scheduled (protected by \a queue_mutex)
+    bool m_grow_armed{ false };
+
+    /// \brief Idle time after which surplus workers of an elastic pool exit
+    dsn::chrono::clock_type::duration m_keep_alive;
+
+    /// \brief Per-worker task deques (only used in work-stealing mode)
+    std::vector<std::unique_ptr<worker_queue> > m_local_queues;
+
+    /// \brief NUMA nodes the workers are distributed across (a single one unless NUMA-aware)
+    std::vector<std::unique_ptr<node> > m_nodes;
+
+    /// \brief Node of each worker slot
+    std::vector<size_t> m_slot_nodes;
+
+    /// \brief CPUs each worker slot is pinned to (empty = no pinning)
+    std::vector<std::vector<unsigned> > m_slot_cpus;
+
+    /// \brief Round-robin counter for distributing external submissions across nodes
+    std::atomic<size_t> m_next_node{ 0 };
+
+    /// \brief Number of priority levels
+    size_t m_levels{ 1 };
+
+    /// \brief Shared task queues, one per node and priority level (protected by \a queue_mutex)
+    ///
+    /// The queue for level \p l of node \p n is at index \p n * \a m_levels + \p l.
+    std::vector<std::unique_ptr<lane> > m_lanes;
+
+    /// \brief Dequeue order across \a m_lanes
+    priority_policy m_priority_policy{ priority_policy::strict };
+
+    /// \brief Lock-free ring in front of \a m_lanes for \a queue_policy::lock_free (\p nullptr otherwise)
+    std::unique_ptr<injection_queue> m_injection;
 
     /// \brief Mutex for synchronized access to task queue
     std::mutex queue_mutex;
@@ -79,12 +884,85 @@ private:
     /// \brief Condition variable for state change notifications
     std::condition_variable condition;
 
+    /// \brief Condition variable for producers waiting for room in a full queue
+    std::condition_variable m_not_full;
+
+    /// \brief Maximum number of tasks in \a m_lanes (0 = unbounded)
+    size_t m_capacity{ 0 };
+
+    /// \brief Policy for submissions while \a m_lanes are full
+    overflow_policy m_overflow{ overflow_policy::block };
+
+    /// \brief Number of tasks in \a m_lanes (protected by \a queue_mutex)
+    size_t m_queued{ 0 };
+
+    /// \brief Number of cancelled tasks in \a m_lanes that no longer count toward \a m_capacity (protected by
+    ///     \a queue_mutex)
+    size_t m_cancelled{ 0 };
+
+    /// \brief Number of producers blocked on \a m_not_full (protected by \a queue_mutex)
+    size_t m_blocked_producers{ 0 };
+
     /// \brief Flag to indicate wether pool execution shall be stopped
-    bool m_stop{ false };
+    std::atomic<bool> m_stop{ false };
+
+    /// \brief Flag to make workers exit without draining the queues (set under \a queue_mutex)
+    std::atomic<bool> m_abort{ false };
+
+    /// \brief Condition variable for workers exiting after the pool was stopped
+    std::condition_variable m_exited;
 
     /// \brief Number of currently idle worker threads
     std::atomic<size_t> m_idle_workers{ 0 };
+
+    /// \brief Number of tasks waiting in any of the pool's queues
+    std::atomic<size_t> m_pending{ 0 };
+
+    /// \brief Number of workers blocked on \a condition
+    std::atomic<size_t> m_sleeping{ 0 };
+
+    /// \brief Number of workers busy-waiting for new tasks
+    std::atomic<size_t> m_spinning{ 0 };
+
+    /// \brief How idle workers wait for new tasks
+    wait_strategy m_wait_strategy{ wait_strategy::block };
+
+    /// \brief Busy-wait iterations before yielding/blocking
+    unsigned m_spin_count{ 0 };
+
+    /// \brief Yields before blocking for \a wait_strategy::spin_yield
+    unsigned m_yield_count{ 0 };
+
+    /// \brief Flag to indicate whether the work-stealing scheduler is enabled
+    bool m_work_stealing{ false };
+
+    /// \brief Pending delayed and periodic tasks
+    std::unique_ptr<timer_queue> m_timers;
+
+    /// \brief Counters for \a metrics()
+    std::unique_ptr<metrics_state> m_metrics;
+
+    /// \brief Hooks for worker start and exit
+    std::function<void(size_t)> m_on_worker_start;
+    std::function<void(size_t)> m_on_worker_stop;
+
+    /// \brief Context of each worker slot (only accessed by the slot's worker thread)
+    std::vector<std::shared_ptr<void> > m_worker_contexts;
+
+    /// \brief Flag to indicate whether new tasks are timed and counted
+    std::atomic<bool> m_metrics_enabled{ false };
 };
+
+/// \brief Queue the resumption of \a handle on the pool
+template <class Handle> void schedule_operation::await_suspend(Handle handle)
+{
+    try {
+        m_pool.post(m_options, resumption<Handle>(handle, this));
+    } catch (...) {
+        // the destroyed resumption task already resumed the coroutine with an error (and it may have
+        // finished since), so neither the exception nor this object must be touched anymore
+    }
+}
 }
 
 #endif
@@ -0,0 +1,274 @@
+#ifndef THREADPOOL_COROUTINE_H
+#define THREADPOOL_COROUTINE_H 1
+
+#if !defined(__cpp_impl_coroutine) || __cpp_impl_coroutine < 201902L
+#error "dsnutil/threadpool_coroutine.h requires C++20 coroutine support"
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <dsnutil/threadpool.h>
+
+/// \brief Coroutine support for \p dsn::ThreadPool (C++20 only)
+///
+/// Coroutines hop onto the pool with \p co_await \p pool.schedule() and compose with \a task<T>.
+/// A suspended coroutine doesn't occupy a worker, so many in-flight coroutines can share a few threads.
+namespace dsn {
+namespace coro {
+
+    template <class T = void> class task;
+
+    namespace detail {
+        /// \brief Result-independent part of a \a task promise
+        struct promise_base {
+            /// \brief Coroutine that awaits this task (resumed by symmetric transfer when it finishes)
+            std::coroutine_handle<> continuation{ std::noop_coroutine() };
+
+            std::exception_ptr exception;
+
+            struct final_awaiter {
+                bool await_ready() const noexcept { return false; }
+
+                template <class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+                {
+                    return handle.promise().continuation;
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            final_awaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() noexcept { exception = std::current_exception(); }
+        };
+
+        template <class T> struct promise : promise_base {
+            std::optional<T> value;
+
+            task<T> get_return_object() noexcept;
+
+            template <class U> void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+            T result()
+            {
+                if (exception) {
+                    std::rethrow_exception(exception);
+                }
+                return std::move(*value);
+            }
+        };
+
+        template <> struct promise<void> : promise_base {
+            task<void> get_return_object() noexcept;
+
+            void return_void() const noexcept {}
+
+            void result()
+            {
+                if (exception) {
+                    std::rethrow_exception(exception);
+                }
+            }
+        };
+    }
+
+    /// \brief Lazily started coroutine producing a \a T
+    ///
+    /// The coroutine starts when the task is awaited and the awaiting coroutine continues on whatever
+    /// thread the task finished on, so once a task hopped onto a pool its continuations run there as
+    /// well. Use \a sync_wait() to wait for a task from ordinary code and \a spawn() to start one
+    /// without waiting.
+    template <class T> class task {
+    public:
+        using promise_type = detail::promise<T>;
+
+        task(task&& other) noexcept
+            : m_handle(std::exchange(other.m_handle, {}))
+        {
+        }
+
+        task& operator=(task&& other) noexcept
+        {
+            if (this != &other) {
+                if (m_handle) {
+                    m_handle.destroy();
+                }
+                m_handle = std::exchange(other.m_handle, {});
+            }
+            return *this;
+        }
+
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+
+        ~task()
+        {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept { return m_handle.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            m_handle.promise().continuation = awaiting;
+            return m_handle;
+        }
+
+        T await_resume() { return m_handle.promise().result(); }
+
+    private:
+        friend struct detail::promise<T>;
+
+        explicit task(std::coroutine_handle<promise_type> handle) noexcept
+            : m_handle(handle)
+        {
+        }
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    namespace detail {
+        template <class T> task<T> promise<T>::get_return_object() noexcept
+        {
+            return task<T>(std::coroutine_handle<promise<T> >::from_promise(*this));
+        }
+
+        inline task<void> promise<void>::get_return_object() noexcept
+        {
+            return task<void>(std::coroutine_handle<promise<void> >::from_promise(*this));
+        }
+
+        /// \brief One-shot event for \a sync_wait()
+        struct sync_event {
+            std::mutex mutex;
+            std::condition_variable condition;
+            bool done{ false };
+
+            void set()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+                condition.notify_all();
+            }
+
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return done; });
+            }
+        };
+
+        /// \brief Coroutine that signals a \a sync_event when it finishes
+        struct sync_wait_task {
+            struct promise_type {
+                sync_event* event{ nullptr };
+
+                sync_wait_task get_return_object() noexcept
+                {
+                    return sync_wait_task(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                std::suspend_always initial_suspend() const noexcept { return {}; }
+
+                auto final_suspend() const noexcept
+                {
+                    struct awaiter {
+                        bool await_ready() const noexcept { return false; }
+                        void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+                        {
+                            handle.promise().event->set();
+                        }
+                        void await_resume() const noexcept {}
+                    };
+                    return awaiter{};
+                }
+
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+
+            explicit sync_wait_task(std::coroutine_handle<promise_type> h) noexcept
+                : handle(h)
+            {
+            }
+
+            std::coroutine_handle<promise_type> handle;
+
+            sync_wait_task(const sync_wait_task&) = delete;
+            sync_wait_task& operator=(const sync_wait_task&) = delete;
+            ~sync_wait_task() { handle.destroy(); }
+        };
+
+        /// \brief Wait for \a t to finish without retrieving its result
+        template <class T> sync_wait_task complete(task<T>& t)
+        {
+            struct awaiter {
+                task<T>& t;
+
+                bool await_ready() const noexcept { return t.await_ready(); }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+                {
+                    return t.await_suspend(awaiting);
+                }
+                void await_resume() const noexcept {}
+            };
+            co_await awaiter{ t };
+        }
+
+        /// \brief Coroutine that isn't awaited by anybody and frees itself when it finishes
+        struct detached_task {
+            struct promise_type {
+                detached_task get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+        };
+
+        inline detached_task run_detached(ThreadPool& pool, task<void> t, task_options options)
+        {
+            co_await pool.schedule(options);
+            co_await t;
+        }
+    }
+
+    /// \brief Run a task to completion and return its result
+    ///
+    /// Blocks the calling thread; don't call this from a pool worker that the task needs.
+    ///
+    /// \throw Rethrows the exception that escaped the task
+    template <class T> T sync_wait(task<T> t)
+    {
+        detail::sync_event event;
+        auto waiter = detail::complete(t);
+        waiter.handle.promise().event = &event;
+        waiter.handle.resume();
+        event.wait();
+        return t.await_resume();
+    }
+
+    /// \brief Start a task on \a pool without waiting for it
+    ///
+    /// \note Exceptions escaping \a t terminate the program since there is nobody to report them to. The
+    /// same goes for spawning on a stopped pool.
+    ///
+    /// \param pool Thread pool the task starts on
+    /// \param t Task to run
+    /// \param options Per-task parameters for the start (e.g. priority level or NUMA node)
+    inline void spawn(ThreadPool& pool, task<void> t, const task_options& options = task_options())
+    {
+        detail::run_detached(pool, std::move(t), options);
+    }
+}
+}
+
+#endif // THREADPOOL_COROUTINE_H
@@ -3,37 +3,280 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <dsnutil/parallel_for.h>
+#include <dsnutil/threadpool.h>
+
+namespace {
+
+/** @brief State shared by the threads taking part in one loop
+ *
+ * Indices are handed out in contiguous chunks according to the loop's schedule. Helper tasks that
+ * only start after the calling thread finished its share find the loop closed and return without
+ * touching the loop body, so the caller never waits for helpers that are still queued.
+ */
+class loop_state {
+    const std::function<void(size_t, size_t)>& m_body;
+    const size_t m_size;
+    const dsn::loop_schedule m_schedule;
+    const size_t m_grain;
+    const size_t m_participants;
+
+    /// @brief Next unclaimed index (dynamic and guided schedules)
+    std::atomic<size_t> m_next{ 0 };
+
+    /// @brief Next unclaimed share of chunks (fixed schedule)
+    std::atomic<size_t> m_next_share{ 0 };
+
+    /// @brief Set once an iteration threw, so the others stop at their next chunk
+    std::atomic<bool> m_failed{ false };
+
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    size_t m_running{ 0 };
+    bool m_closed{ false };
+    std::exception_ptr m_exception;
+
+public:
+    loop_state(const std::function<void(size_t, size_t)>& body, size_t size, const dsn::loop_options& options,
+        size_t participants)
+        : m_body(body)
+        , m_size(size)
+        , m_schedule(options.schedule)
+        , m_grain(std::min(options.grain != 0 ? options.grain : default_grain(options.schedule, size, participants), size))
+        , m_participants(participants)
+    {
+    }
+
+    static size_t default_grain(dsn::loop_schedule schedule, size_t size, size_t participants)
+    {
+        switch (schedule) {
+        case dsn::loop_schedule::fixed:
+            return (size + participants - 1) / participants;
+        case dsn::loop_schedule::dynamic:
+            // a few chunks per participant balance uneven iterations without contending on the counter
+            return std::max<size_t>(size / (participants * 4), 1);
+        case dsn::loop_schedule::guided:
+            break;
+        }
+        return 1;
+    }
+
+    /// @brief Join the loop unless the calling thread already finished it
+    bool enter()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closed) {
+            return false;
+        }
+        m_running++;
+        return true;
+    }
+
+    /// @brief Leave the loop after \a enter() returned true
+    void leave()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_running == 0 && m_closed) {
+            m_done.notify_all();
+        }
+    }
+
+    /// @brief Process chunks until all indices are taken
+    void work()
+    {
+        try {
+            switch (m_schedule) {
+            case dsn::loop_schedule::fixed:
+                work_fixed();
+                break;
+            case dsn::loop_schedule::dynamic:
+                work_dynamic();
+                break;
+            case dsn::loop_schedule::guided:
+                work_guided();
+                break;
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_exception) {
+                m_exception = std::current_exception();
+            }
+            m_failed = true;
+        }
+    }
+
+private:
+    void run(size_t begin, size_t end) { m_body(begin, end); }
+
+    /// @brief Chunk @p c goes to share @p c % participants; shares whose helper never showed up are
+    /// taken over by whoever finishes first
+    void work_fixed()
+    {
+        const size_t stride = m_participants * m_grain;
+        for (size_t share = m_next_share++; share < m_participants; share = m_next_share++) {
+            size_t begin = share * m_grain;
+            while (begin < m_size && !m_failed) {
+                run(begin, std::min(begin + m_grain, m_size));
+                if (m_size - begin <= stride) {
+                    break;
+                }
+                begin += stride;
+            }
+        }
+    }
+
+    void work_dynamic()
+    {
+        while (!m_failed) {
+            const size_t begin = m_next.fetch_add(m_grain);
+            if (begin >= m_size) {
+                return;
+            }
+            run(begin, std::min(begin + m_grain, m_size));
+        }
+    }
+
+    void work_guided()
+    {
+        size_t begin = m_next.load();
+        while (!m_failed) {
+            if (begin >= m_size) {
+                return;
+            }
+            const size_t chunk = std::max((m_size - begin) / (2 * m_participants), m_grain);
+            const size_t end = std::min(begin + chunk, m_size);
+            if (m_next.compare_exchange_weak(begin, end)) {
+                run(begin, end);
+                begin = m_next.load();
+            }
+        }
+    }
+
+public:
+
+    /// @brief Keep late helpers out, wait for the running ones and rethrow the first exception
+    void finish()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_done.wait(lock, [this]() { return m_running == 0; });
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+};
+
+}
+
+/** @brief Run a loop on the calling thread and workers of a thread pool
+ *
+ * Common backend of all @p parallel_for() variants. The body is called once per chunk, so the
+ * type-erased call doesn't get in the way of optimizing the per-index code.
+ *
+ * @param pool Thread pool whose workers help with the loop
+ * @param size Total number of indices
+ * @param body Loop body for the half-open index range [begin, end)
+ * @param options How the indices are split into chunks
+ * @param helpers Max # of workers to involve besides the calling thread
+ *
+ * @throw Rethrows the first exception thrown by @p body once all threads stopped working on the loop
+ */
+void dsn::detail::run_loop(ThreadPool& pool, size_t size, const std::function<void(size_t, size_t)>& body,
+    const loop_options& options, size_t helpers)
+{
+    if (size == 0) {
+        return;
+    }
+
+    helpers = std::min({ helpers, pool.num_workers(), size - 1 });
+    if (helpers == 0) {
+        body(0, size);
+        return;
+    }
+
+    auto state = std::make_shared<loop_state>(body, size, options, helpers + 1);
+    auto helper = [state]() {
+        if (state->enter()) {
+            state->work();
+            state->leave();
+        }
+    };
+
+    try {
+        std::vector<decltype(helper)> batch(helpers, helper);
+        pool.post_bulk(batch.begin(), batch.end());
+    } catch (const dsn::Exception&) {
+        // the pool is stopped or full; whoever got queued helps, the caller does the rest
+    }
+
+    state->work();
+    state->finish();
+}
+
+/** @brief Get the thread pool shared by all parallel loops that don't bring their own
+ *
+ * The pool has one worker per CPU core and is created on first use.
+ */
+dsn::ThreadPool& dsn::parallel_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
 
 /** @brief Parallelized loop
  *
  * This helper can be used to parallelize the execution of a worker function over any data
- * container.
+ * container. It runs on the shared @p parallel_pool() with the calling thread taking part.
  *
  * @param size Total number of worker tasks
  * @param func Worker function (can be lambda)
- * @param numThreads Max # of threads to use; clamped to # of CPU cores
+ * @param numThreads Max # of threads to use (including the calling one); clamped to # of CPU cores
+ *
+ * @throw Rethrows the first exception thrown by @p func once all threads stopped working on the loop
  */
 void dsn::parallel_for(const size_t size, std::function<void(const size_t)> func, unsigned numThreads)
 {
-    // clamp numThreads to # of CPU cores
-    numThreads = std::min(numThreads, std::thread::hardware_concurrency());
-    std::vector<std::thread> threads;
-
-    // start worker threads
-    for (size_t threadID = 0; threadID < numThreads; ++threadID) {
-        auto thread_func = [&]() {
-            for (size_t i = threadID; i < size; i += numThreads) {
-                func(i);
-            }
-        };
-        threads.push_back(std::thread(thread_func));
-    }
+    detail::run_loop(
+        parallel_pool(), size, detail::index_body<decltype(func)>(func), loop_options(), detail::helpers_for(numThreads));
+}
 
-    // wait for all threads to finish
-    for (auto& thread : threads) {
-        thread.join();
-    }
+/** @brief Parallelized loop with explicit scheduling
+ *
+ * Runs on the shared @p parallel_pool() with the calling thread taking part.
+ *
+ * @param size Total number of worker tasks
+ * @param func Worker function (can be lambda)
+ * @param options How the indices are split into chunks
+ *
+ * @throw Rethrows the first exception thrown by @p func once all threads stopped working on the loop
+ */
+void dsn::parallel_for(const size_t size, std::function<void(const size_t)> func, const loop_options& options)
+{
+    detail::run_loop(parallel_pool(), size, detail::index_body<decltype(func)>(func), options, detail::all_workers);
+}
+
+/** @brief Parallelized loop on a given thread pool
+ *
+ * Contiguous chunks of indices are distributed among the calling thread and the workers of @p pool
+ * (see @p loop_schedule). Workers that are busy with other tasks join in once they get to it, so this
+ * can be called from inside one of the pool's tasks as well.
+ *
+ * @param pool Thread pool whose workers help with the loop
+ * @param size Total number of worker tasks
+ * @param func Worker function (can be lambda)
+ * @param options How the indices are split into chunks
+ *
+ * @throw Rethrows the first exception thrown by @p func once all threads stopped working on the loop
+ */
+void dsn::parallel_for(
+    ThreadPool& pool, const size_t size, std::function<void(const size_t)> func, const loop_options& options)
+{
+    detail::run_loop(pool, size, detail::index_body<decltype(func)>(func), options, detail::all_workers);
 }
@@ -0,0 +1,113 @@
+#include <dsnutil/pool_future.h>
+
+/// \brief Create an unsatisfied state
+///
+/// \param pool Thread pool that runs continuations or \p nullptr to run them inline
+dsn::detail::future_state_base::future_state_base(ThreadPool* pool)
+    : m_pool(pool)
+{
+}
+
+dsn::detail::future_state_base::~future_state_base() {}
+
+/// \brief Lock the state for storing a result
+///
+/// \throw std::future_error if a result has already been stored
+std::unique_lock<std::mutex> dsn::detail::future_state_base::lock_unsatisfied()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_ready) {
+        throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+    return lock;
+}
+
+/// \brief Mark the state as ready, wake up waiters and run the registered callbacks
+///
+/// \param lock Lock on \a m_mutex; released by this call
+void dsn::detail::future_state_base::make_ready(std::unique_lock<std::mutex>& lock)
+{
+    m_ready = true;
+    std::vector<dsn::task> callbacks;
+    callbacks.swap(m_callbacks);
+    lock.unlock();
+
+    m_ready_condition.notify_all();
+    for (auto& callback : callbacks) {
+        callback();
+    }
+}
+
+/// \brief Check whether a result has been stored
+bool dsn::detail::future_state_base::is_ready()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ready;
+}
+
+/// \brief Check whether a \p dsn::task_cancelled exception has been stored
+bool dsn::detail::future_state_base::is_cancelled()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cancelled;
+}
+
+/// \brief Block until a result has been stored
+void dsn::detail::future_state_base::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_ready_condition.wait(lock, [this]() { return m_ready; });
+}
+
+/// \brief Block until a result has been stored or \a deadline passed
+///
+/// \return true if the result is available
+bool dsn::detail::future_state_base::wait_until(const dsn::chrono::clock_type::time_point& deadline)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_ready_condition.wait_until(lock, deadline, [this]() { return m_ready; });
+}
+
+/// \brief Store an exception as the result
+///
+/// \throw std::future_error if a result has already been stored
+void dsn::detail::future_state_base::set_exception(std::exception_ptr exception)
+{
+    bool cancelled{ false };
+    try {
+        std::rethrow_exception(exception);
+    } catch (const dsn::task_cancelled&) {
+        cancelled = true;
+    } catch (...) {
+    }
+
+    auto lock = lock_unsatisfied();
+    m_exception = exception;
+    m_cancelled = cancelled;
+    make_ready(lock);
+}
+
+/// \brief Rethrow the stored exception (if any)
+///
+/// \note Requires the state to be ready
+void dsn::detail::future_state_base::rethrow_if_failed()
+{
+    if (m_exception) {
+        std::rethrow_exception(m_exception);
+    }
+}
+
+/// \brief Register a callback for when the state becomes ready
+///
+/// \param callback Callable that is invoked once; immediately if the state is ready already
+void dsn::detail::future_state_base::add_callback(dsn::task&& callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_ready) {
+            m_callbacks.push_back(std::move(callback));
+            return;
+        }
+    }
+    callback();
+}
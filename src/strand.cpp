@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <thread>
+
+#include <dsnutil/strand.h>
+
+const size_t dsn::strand::max_batch;
+
+/// \brief Initialize an empty queue
+dsn::strand::state::state(ThreadPool& p, const task_options& o)
+    : pool(p)
+    , options(o)
+    , head(&stub)
+    , tail(&stub)
+{
+}
+
+/// \brief Free tasks that never ran
+dsn::strand::state::~state()
+{
+    while (node* n = pop()) {
+        delete n;
+    }
+}
+
+/// \brief Append a node (safe to call from any thread)
+void dsn::strand::state::push(node_base* n)
+{
+    n->next.store(nullptr, std::memory_order_relaxed);
+    node_base* prev = head.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+}
+
+/// \brief Remove the oldest node (only called by the current drain)
+///
+/// \return Oldest node or \p nullptr if the queue is empty or a producer is halfway through \a push()
+dsn::strand::node* dsn::strand::state::pop()
+{
+    node_base* first = tail;
+    node_base* next = first->next.load(std::memory_order_acquire);
+    if (first == &stub) {
+        if (!next) {
+            return nullptr;
+        }
+        tail = next;
+        first = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        tail = next;
+        return static_cast<node*>(first);
+    }
+
+    if (first != head.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    // first is the only node; put the stub behind it so it can be detached
+    push(&stub);
+    next = first->next.load(std::memory_order_acquire);
+    if (next) {
+        tail = next;
+        return static_cast<node*>(first);
+    }
+    return nullptr;
+}
+
+/// \brief Drain task that a strand posts to its pool
+///
+/// A drain task that is destroyed without having run was discarded by the pool. Unless the submitter
+/// is still inside \p post() (it falls back to draining on its own thread then) the strand's queued
+/// tasks are discarded too, since no other drain would ever pick them up.
+struct dsn::strand::drain_task {
+    /// \brief Hand-off between the submitter and a discarded drain task
+    enum { posting, posted, dropped };
+
+    drain_task(const std::shared_ptr<state>& st, const std::shared_ptr<std::atomic<int> >& t)
+        : s(st)
+        , ticket(t)
+    {
+    }
+
+    drain_task(drain_task&& other) dsnutil_cpp_NOEXCEPT
+        : s(std::move(other.s))
+        , ticket(std::move(other.ticket))
+    {
+    }
+
+    ~drain_task()
+    {
+        if (s && ticket->exchange(dropped) == posted) {
+            discard(s);
+        }
+    }
+
+    void operator()()
+    {
+        auto self = std::move(s);
+        drain(self);
+    }
+
+    std::shared_ptr<state> s;
+    std::shared_ptr<std::atomic<int> > ticket;
+};
+
+/// \brief Create a strand on \a pool
+///
+/// \param pool Thread pool that runs the strand's tasks
+/// \param options Submission options for the strand's drain tasks (e.g. priority level or NUMA node)
+///
+/// \throw dsn::Exception if \a options carries a cancellation token; a drain task runs the tasks of many
+///     submitters, so skipping it would silently drop all of them
+dsn::strand::strand(ThreadPool& pool, const task_options& options)
+    : m_state(std::make_shared<state>(pool, options))
+{
+    if (options.token.can_be_cancelled()) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("Strands don't support cancellation tokens!");
+    }
+}
+
+/// \brief Queue a task and schedule a drain if the strand was idle
+///
+/// If the pool refuses the drain task (e.g. because it has been stopped) the drain runs on the calling thread
+/// instead.
+void dsn::strand::submit(dsn::task&& task)
+{
+    m_state->push(new node(std::move(task)));
+    if (m_state->count.fetch_add(1, std::memory_order_acq_rel) != 0) {
+        // a drain is active and will pick the task up
+        return;
+    }
+
+    if (!schedule(m_state)) {
+        drain(m_state);
+    }
+}
+
+/// \brief Post a drain task for \a s
+///
+/// \return false if the pool refused the drain task (e.g. because it has been stopped); the caller has to
+///     drain on its own thread then
+bool dsn::strand::schedule(const std::shared_ptr<state>& s)
+{
+    auto ticket = std::make_shared<std::atomic<int> >(drain_task::posting);
+    try {
+        s->pool.post(s->options, drain_task(s, ticket));
+    } catch (const dsn::Exception&) {
+        return false;
+    }
+
+    if (ticket->exchange(drain_task::posted) == drain_task::dropped) {
+        // discarded before post() even returned
+        discard(s);
+    }
+    return true;
+}
+
+/// \brief Run queued tasks of a strand in order
+///
+/// Only one drain per strand is active at any time: it's scheduled by the submission that raises
+/// \a count from zero and it ends when it brings \a count back to zero.
+void dsn::strand::drain(const std::shared_ptr<state>& s)
+{
+    size_t remaining = s->count.load(std::memory_order_acquire);
+    for (;;) {
+        const size_t batch = std::min(remaining, max_batch);
+        for (size_t i = 0; i < batch; ++i) {
+            node* n;
+            while (!(n = s->pop())) {
+                // the task is counted but its producer hasn't linked it yet
+                std::this_thread::yield();
+            }
+            n->fn();
+            delete n;
+        }
+
+        remaining = s->count.fetch_sub(batch, std::memory_order_acq_rel) - batch;
+        if (remaining == 0) {
+            return;
+        }
+
+        if (batch == max_batch) {
+            // give other work on the pool a chance before continuing; keep draining here if it's stopped
+            if (schedule(s)) {
+                return;
+            }
+        }
+    }
+}
+
+/// \brief Destroy the queued tasks of a strand whose drain task was discarded
+///
+/// Tasks submitted while this is running are drained as usual.
+void dsn::strand::discard(const std::shared_ptr<state>& s)
+{
+    const size_t dropped = s->count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < dropped; ++i) {
+        node* n;
+        while (!(n = s->pop())) {
+            std::this_thread::yield();
+        }
+        delete n;
+    }
+
+    if (s->count.fetch_sub(dropped, std::memory_order_acq_rel) != dropped && !schedule(s)) {
+        drain(s);
+    }
+}
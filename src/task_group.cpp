@@ -0,0 +1,100 @@
+#include <dsnutil/task_group.h>
+
+/// \brief Create an empty task group
+///
+/// \param pool Thread pool that runs the tasks of this group
+dsn::task_group::task_group(ThreadPool& pool)
+    : m_pool(pool)
+{
+}
+
+/// \brief Wait for all tasks of this group before destroying it
+dsn::task_group::~task_group() { wait_until(nullptr); }
+
+/// \brief Wait for all tasks of this group
+///
+/// On a worker of the group's pool this executes queued tasks (of any group) while waiting; other
+/// threads block.
+///
+/// \throw Rethrows the first exception thrown by a task of this group
+void dsn::task_group::wait()
+{
+    wait_until(nullptr);
+    rethrow();
+}
+
+/// \brief Mark one task as finished
+///
+/// Only the decrement that may reach zero takes the mutex; a waiter that saw zero acquires it before
+/// returning, so the group can't be destroyed while \a m_done is still being notified.
+void dsn::task_group::finish()
+{
+    size_t pending = m_pending.load();
+    while (pending > 1 && !m_pending.compare_exchange_weak(pending, pending - 1)) {
+    }
+    if (pending > 1) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_pending == 0) {
+        m_done.notify_all();
+    }
+}
+
+/// \brief Record an exception thrown by a task (only the first one is kept)
+void dsn::task_group::set_exception(std::exception_ptr exception)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_exception) {
+        m_exception = exception;
+    }
+}
+
+/// \brief Rethrow and clear a recorded exception
+void dsn::task_group::rethrow()
+{
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(exception, m_exception);
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+/// \brief Wait until all tasks finished or \a deadline passed
+///
+/// \param deadline Time limit or \p nullptr to wait indefinitely
+///
+/// \return true if all tasks finished
+bool dsn::task_group::wait_until(const dsn::chrono::clock_type::time_point* deadline)
+{
+    const bool helping = m_pool.is_worker_thread();
+    auto done = [this]() { return m_pending.load() == 0; };
+
+    while (!done()) {
+        if (deadline && dsn::chrono::clock_type::now() >= *deadline) {
+            return false;
+        }
+
+        if (helping && m_pool.run_pending_task()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (helping) {
+            // our tasks are running on other workers; look out for tasks they queue in the meantime
+            m_done.wait_for(lock, std::chrono::microseconds(100), done);
+        } else if (deadline) {
+            m_done.wait_until(lock, *deadline, done);
+        } else {
+            m_done.wait(lock, done);
+        }
+    }
+
+    // synchronize with the final finish() that might still hold the mutex
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return true;
+}
@@ -1,62 +1,1886 @@
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <queue>
+#include <sstream>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
 #include <dsnutil/threadpool.h>
 
 using namespace dsn;
 
+namespace {
+/// \brief Pool owning the calling thread (nullptr for non-worker threads)
+thread_local ThreadPool* t_current_pool{ nullptr };
+
+/// \brief Index of the calling thread in \a t_current_pool
+thread_local size_t t_current_index{ 0 };
+
+/// \brief Delay before the timer thread retries queueing a one-shot timer that didn't fit into a full queue
+const std::chrono::milliseconds timer_retry_delay(1);
+
+/// \brief Tell the CPU that we're in a spin-wait loop
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+/// \brief Join the threads of retired workers
+///
+/// \note Never call this while holding \a ThreadPool::queue_mutex: a retiring worker still runs its
+/// \a thread_pool_options::on_worker_stop hook after leaving the worker loop.
+void join_all(std::vector<std::thread>& threads)
+{
+    for (auto& thread : threads) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // can't wait for ourselves; the thread is about to exit anyway
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+    threads.clear();
+}
+
+/// \brief Parse a Linux CPU list like "0-3,8-11"
+///
+/// \param list CPU list in the format used by sysfs
+///
+/// \return CPU indices contained in \a list
+std::vector<unsigned> parse_cpu_list(const std::string& list)
+{
+    std::vector<unsigned> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        auto dash = range.find('-');
+        unsigned first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+        unsigned last = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+        for (unsigned cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/// \brief Pin the calling thread to a set of CPUs
+///
+/// \param cpus CPU indices the thread may run on; does nothing if empty
+void pin_current_thread(const std::vector<unsigned>& cpus)
+{
+    if (cpus.empty()) {
+        return;
+    }
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(WIN32)
+    DWORD_PTR mask{ 0 };
+    for (auto cpu : cpus) {
+        if (cpu < sizeof(mask) * 8) {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+    if (mask != 0) {
+        SetThreadAffinityMask(GetCurrentThread(), mask);
+    }
+#endif
+}
+}
+
+std::vector<std::vector<unsigned> > dsn::numa_topology()
+{
+    std::vector<std::vector<unsigned> > nodes;
+
+#if defined(__linux__)
+    for (unsigned node = 0;; ++node) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!cpulist) {
+            break;
+        }
+        std::string list;
+        std::getline(cpulist, list);
+        auto cpus = parse_cpu_list(list);
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+#endif
+
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (unsigned cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); ++cpu) {
+            nodes.back().push_back(cpu);
+        }
+    }
+
+    return nodes;
+}
+
+/// \brief Local task deque of a single worker
+///
+/// The owning worker pushes and pops at the back while other workers steal from the front, so
+/// the owner processes its most recent (cache-hot) tasks first and thieves take the oldest ones.
+struct ThreadPool::worker_queue {
+    std::mutex mutex;
+    std::deque<dsn::task> tasks;
+};
+
+/// \brief Shared queue for a single priority level
+struct ThreadPool::lane {
+    /// \brief Queued tasks (protected by \a ThreadPool::queue_mutex)
+    std::queue<dsn::task> tasks;
+
+    /// \brief Enqueue time of each task in \a tasks (only maintained for elastic pools)
+    std::queue<dsn::chrono::clock_type::time_point> enqueued;
+
+    /// \brief Number of queued tasks at this level (readable without locking)
+    ///
+    /// For level 0 this includes the tasks on the workers' local deques.
+    std::atomic<size_t> depth{ 0 };
+
+    /// \brief Number of tasks per round for \a priority_policy::weighted_fair
+    unsigned weight{ 1 };
+
+    /// \brief Tasks left in the current round for \a priority_policy::weighted_fair
+    unsigned credits{ 0 };
+};
+
+/// \brief Per-node bookkeeping
+struct ThreadPool::node {
+    /// \brief Number of live workers on this node
+    std::atomic<size_t> workers{ 0 };
+
+    /// \brief Number of idle workers on this node
+    std::atomic<size_t> idle{ 0 };
+};
+
+/// \brief Bounded lock-free MPMC queue (D. Vyukov) for \a queue_policy::lock_free
+///
+/// Each cell carries a sequence number that tells producers and consumers whose turn it is, so
+/// they only contend on the head or tail counter and never on a lock.
+struct ThreadPool::injection_queue {
+    struct cell {
+        std::atomic<size_t> sequence;
+        dsn::task task;
+    };
+
+    explicit injection_queue(size_t capacity)
+    {
+        size_t size{ 2 };
+        while (size < capacity) {
+            size <<= 1;
+        }
+        cells.reset(new cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// \brief Append a task
+    ///
+    /// \return false if the ring is full (\a task is left untouched then)
+    bool push(dsn::task& task)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos & mask];
+            const size_t sequence = c.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.task = std::move(task);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// \brief Remove the oldest task
+    ///
+    /// \return false if the ring is empty or its oldest slot is still being written
+    bool pop(dsn::task& task)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos & mask];
+            const size_t sequence = c.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    task = std::move(c.task);
+                    c.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<cell[]> cells;
+    size_t mask;
+
+    // keep producers and consumers off each other's cache line
+    char padding0[64];
+    std::atomic<size_t> enqueue_pos{ 0 };
+    char padding1[64];
+    std::atomic<size_t> dequeue_pos{ 0 };
+    char padding2[64];
+};
+
+/// \brief Histogram with logarithmic buckets (see \p thread_pool_metrics)
+class duration_histogram {
+    std::atomic<unsigned long long> m_buckets[thread_pool_metrics::histogram_buckets];
+
+public:
+    duration_histogram() { reset(); }
+
+    void record(dsn::chrono::clock_type::duration d)
+    {
+        auto ns = static_cast<unsigned long long>(std::max<long long>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), 0));
+        size_t bucket{ 0 };
+        while (ns >>= 1) {
+            bucket++;
+        }
+        m_buckets[std::min(bucket, thread_pool_metrics::histogram_buckets - 1)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void read(thread_pool_metrics::histogram& out) const
+    {
+        for (size_t i = 0; i < out.size(); ++i) {
+            out[i] = m_buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void reset()
+    {
+        for (auto& bucket : m_buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+/// \brief Counters behind \a ThreadPool::metrics()
+///
+/// Everything is a relaxed atomic so recording and reading never take a lock.
+struct ThreadPool::metrics_state {
+    /// \brief Busy time of a worker slot, padded to its own cache line
+    struct worker_time {
+        std::atomic<long long> busy_ns{ 0 };
+        char padding[64 - sizeof(std::atomic<long long>)];
+    };
+
+    explicit metrics_state(size_t slots)
+        : workers(new worker_time[slots])
+        , num_workers(slots)
+    {
+        reset(0);
+    }
+
+    void reset(size_t depth)
+    {
+        submitted.store(0, std::memory_order_relaxed);
+        completed.store(0, std::memory_order_relaxed);
+        peak_depth.store(depth, std::memory_order_relaxed);
+        queue_wait.reset();
+        execution_time.reset();
+        for (size_t i = 0; i < num_workers; ++i) {
+            workers[i].busy_ns.store(0, std::memory_order_relaxed);
+        }
+        since.store(dsn::chrono::clock_type::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    std::atomic<unsigned long long> submitted;
+    std::atomic<unsigned long long> completed;
+    std::atomic<size_t> peak_depth;
+    duration_histogram queue_wait;
+    duration_histogram execution_time;
+    std::unique_ptr<worker_time[]> workers;
+    size_t num_workers;
+
+    /// \brief Start of the measurement period (ticks of \p dsn::chrono::clock_type)
+    std::atomic<dsn::chrono::clock_type::rep> since;
+};
+
+/// \brief Task wrapper that records queue wait, execution time and worker busy time
+struct ThreadPool::timed_task {
+    timed_task(ThreadPool* p, dsn::task&& t)
+        : pool(p)
+        , inner(std::move(t))
+        , submitted(dsn::chrono::clock_type::now())
+    {
+    }
+
+    void operator()()
+    {
+        auto& metrics = *pool->m_metrics;
+        const auto start = dsn::chrono::clock_type::now();
+        metrics.queue_wait.record(start - submitted);
+
+        inner();
+
+        const auto elapsed = dsn::chrono::clock_type::now() - start;
+        metrics.execution_time.record(elapsed);
+        metrics.completed.fetch_add(1, std::memory_order_relaxed);
+        if (t_current_pool == pool) {
+            metrics.workers[t_current_index].busy_ns.fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+        }
+    }
+
+    ThreadPool* pool;
+    dsn::task inner;
+    dsn::chrono::clock_type::time_point submitted;
+};
+
+/// \brief State shared by a queued cancellable task and the callback registered with its token
+struct ThreadPool::cancel_slot {
+    /// \brief Protects \a task and \a released
+    std::mutex mutex;
+
+    /// \brief The wrapped task; taken by whichever of the pool and the cancel callback gets to it first
+    dsn::task task;
+
+    /// \brief Pool whose bounded queue holds the task (cleared once the task has left the queue)
+    std::atomic<ThreadPool*> pool{ nullptr };
+
+    /// \brief Whether the cancel callback stopped counting the task toward the queue capacity
+    bool released{ false };
+
+    cancellation_registration registration;
+};
+
+/// \brief Queue entry of a task with a cancellation token
+///
+/// When the token is cancelled its callback runs the wrapped task right away on the cancelling thread,
+/// which completes it as cancelled (see \p detail::cancellable_call and \p detail::skippable_call), so
+/// futures don't wait for a worker to dequeue the task. The entry stays in the queue until then but no
+/// longer counts toward the queue capacity.
+class ThreadPool::cancellable_task {
+    std::shared_ptr<cancel_slot> m_slot;
+
+    /// \brief Take the task out of the slot and undo the capacity release of a cancelled task
+    static dsn::task settle(cancel_slot& slot)
+    {
+        // once this returns the callback has either run or won't run anymore
+        slot.registration.reset();
+
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        ThreadPool* pool = slot.pool.exchange(nullptr);
+        if (pool && slot.released) {
+            std::lock_guard<std::mutex> queue_lock(pool->queue_mutex);
+            pool->m_cancelled--;
+        }
+        return std::move(slot.task);
+    }
+
+public:
+    explicit cancellable_task(std::shared_ptr<cancel_slot> slot)
+        : m_slot(std::move(slot))
+    {
+    }
+
+    cancellable_task(cancellable_task&& other) = default;
+
+    ~cancellable_task()
+    {
+        if (m_slot) {
+            settle(*m_slot);
+        }
+    }
+
+    void operator()()
+    {
+        auto slot = std::move(m_slot);
+        if (auto task = settle(*slot)) {
+            task();
+        }
+    }
+};
+
+/// \brief Timer heap for delayed and periodic tasks
+///
+/// Timers are kept in a binary min-heap ordered by due time that is served by a single thread. Cancelled
+/// timers are only removed from \a entries; their heap nodes are skipped when they come up.
+struct ThreadPool::timer_queue {
+    /// \brief Task payload of a timer
+    struct entry {
+        /// \brief Interval for periodic timers (zero for one-shot timers)
+        dsn::chrono::clock_type::duration period;
+
+        /// \brief Task of a one-shot timer
+        dsn::task once;
+
+        /// \brief Callable of a periodic timer
+        std::shared_ptr<std::function<void()> > repeat;
+    };
+
+    /// \brief Heap node
+    struct due_time {
+        dsn::chrono::clock_type::time_point when;
+        timer_id id;
+
+        bool operator>(const due_time& other) const { return when > other.when; }
+    };
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<due_time> heap;
+    std::unordered_map<timer_id, entry> entries;
+    timer_id next_id{ 1 };
+    bool stop{ false };
+    std::thread thread;
+
+    /// \brief Time of the next growth check of an elastic pool (\p time_point::max() if none is scheduled)
+    dsn::chrono::clock_type::time_point grow_check{ dsn::chrono::clock_type::time_point::max() };
+};
+
 /// \brief Initialize thread pool
 ///
 /// \param size Maximum number of tasks to execute in parallel
 ThreadPool::ThreadPool(size_t size)
+    : ThreadPool([size] {
+        thread_pool_options options;
+        options.num_threads = size;
+        return options;
+    }())
 {
-    for (size_t i = 0; i < size; ++i) {
-        workers.emplace_back([this] {
-            m_idle_workers++;
-            for (;;) {
-                std::unique_lock<std::mutex> lock(this->queue_mutex);
-                while (!this->m_stop && this->tasks.empty()) {
-                    this->condition.wait(lock);
-                }
+}
+
+/// \brief Initialize thread pool
+///
+/// \param options Pool configuration
+ThreadPool::ThreadPool(const thread_pool_options& options)
+    : m_min_workers(options.num_threads)
+    , m_elastic_slots(std::max(options.num_threads, options.max_threads))
+    , m_grow_threshold(options.grow_threshold)
+    , m_keep_alive(options.keep_alive)
+    , m_levels(std::max<size_t>(options.priority_levels, 1))
+    , m_priority_policy(options.priority_mode)
+    , m_capacity(options.queue_capacity)
+    , m_overflow(options.overflow)
+    , m_wait_strategy(options.idle_strategy)
+    , m_spin_count(options.spin_count)
+    , m_yield_count(options.yield_count)
+    , m_work_stealing(options.work_stealing)
+{
+    const size_t slots = m_elastic_slots + options.max_compensating;
+    m_slot_nodes.resize(slots, 0);
+    m_slot_cpus.resize(slots);
 
-                if (this->m_stop && this->tasks.empty()) {
-                    m_idle_workers--;
-                    return;
+    // assign worker slots to nodes and CPUs
+    auto topology = options.numa_aware ? numa_topology() : std::vector<std::vector<unsigned> >(1);
+    for (size_t i = 0; i < slots; ++i) {
+        if (!options.cpu_affinity.empty()) {
+            unsigned cpu = options.cpu_affinity[i % options.cpu_affinity.size()];
+            m_slot_cpus[i].push_back(cpu);
+            for (size_t n = 0; n < topology.size(); ++n) {
+                if (std::find(topology[n].begin(), topology[n].end(), cpu) != topology[n].end()) {
+                    m_slot_nodes[i] = n;
                 }
+            }
+        } else if (options.numa_aware) {
+            m_slot_nodes[i] = i % topology.size();
+            m_slot_cpus[i] = topology[m_slot_nodes[i]];
+        }
+    }
 
-                std::function<void()> task(this->tasks.front());
-                this->tasks.pop();
-                lock.unlock();
-                m_idle_workers--;
-                task();
-                m_idle_workers++;
+    for (size_t n = 0; n < topology.size(); ++n) {
+        m_nodes.emplace_back(new node);
+        for (size_t i = 0; i < m_levels; ++i) {
+            m_lanes.emplace_back(new lane);
+            if (options.priority_weights.size() == m_levels) {
+                m_lanes.back()->weight = std::max(options.priority_weights[i], 1u);
+            } else {
+                m_lanes.back()->weight = static_cast<unsigned>(m_levels - i);
             }
-        });
+        }
+    }
+
+    if (m_work_stealing) {
+        for (size_t i = 0; i < slots; ++i) {
+            m_local_queues.emplace_back(new worker_queue);
+        }
+    }
+
+    m_timers.reset(new timer_queue);
+    m_metrics.reset(new metrics_state(slots));
+    m_on_worker_start = options.on_worker_start;
+    m_on_worker_stop = options.on_worker_stop;
+    m_worker_contexts.resize(slots);
+
+    if (options.queue_mode == queue_policy::lock_free && m_levels == 1 && m_capacity == 0
+        && m_elastic_slots == options.num_threads) {
+        m_injection.reset(new injection_queue(options.ring_capacity));
+    }
+    m_metrics_enabled = options.metrics && metrics_supported();
+
+    workers.resize(slots);
+    m_active_slots.resize(slots, false);
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    for (size_t i = 0; i < options.num_threads; ++i) {
+        spawn_worker(i);
     }
 }
 
 ThreadPool::~ThreadPool() { stop(); }
 
+/// \brief Announce that the calling worker is about to block
+///
+/// Wrap blocking calls (I/O, waiting for locks or futures of other pools, ...) inside tasks with
+/// \code auto region = pool.blocking(); \endcode so the pool can run a compensating worker in the
+/// meantime (up to \a thread_pool_options::max_compensating of them) and other tasks don't starve.
+/// Regions may nest; calls from threads that aren't workers of this pool have no effect.
+///
+/// \return Guard that ends the region when it is destroyed
+ThreadPool::blocking_region ThreadPool::blocking()
+{
+    if (t_current_pool != this) {
+        return blocking_region(nullptr);
+    }
+
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        m_blocking++;
+        if (!m_stop && m_compensating < m_blocking) {
+            for (size_t i = m_elastic_slots; i < workers.size(); ++i) {
+                if (!m_active_slots[i]) {
+                    m_compensating++;
+                    spawn_worker(i);
+                    break;
+                }
+            }
+        }
+        retired.swap(m_retired);
+    }
+    join_all(retired);
+    return blocking_region(this);
+}
+
+/// \brief End a \a blocking() region and let a surplus compensating worker exit
+void ThreadPool::end_blocking()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    m_blocking--;
+    if (m_compensating > m_blocking) {
+        condition.notify_all();
+    }
+}
+
 /// \brief Stop thread pool execution
 ///
 /// Prevents new tasks from being scheduled on the thread pool and ends the worker threads once
-/// they're done processing.
+/// they're done processing. Timers that haven't fired yet are discarded.
 void ThreadPool::stop()
 {
+    begin_stop(false);
+    join_workers();
+}
+
+/// \brief Stop thread pool execution within a deadline
+///
+/// Works like \a stop() until \a deadline has passed; then the workers finish their current task and
+/// exit, and all tasks that are still queued are discarded. Futures of discarded tasks report
+/// \p std::future_errc::broken_promise.
+///
+/// \note Tasks that are already running when the deadline passes are waited for.
+///
+/// \param deadline Time until which queued tasks are still executed (e.g. a \p dsn::chrono::time_point)
+///
+/// \return Number of discarded tasks
+size_t ThreadPool::shutdown(dsn::chrono::clock_type::time_point deadline)
+{
+    begin_stop(false);
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!m_exited.wait_until(lock, deadline, [this]() { return m_num_workers == 0; })) {
+            m_abort = true;
+            condition.notify_all();
+        }
+    }
+    join_workers();
+    return take_queued().size();
+}
+
+/// \brief Stop thread pool execution without draining the queues
+///
+/// The workers finish their current task and exit; tasks that haven't started are handed to the caller,
+/// who can run, persist or drop them. Dropping them makes their futures report
+/// \p std::future_errc::broken_promise.
+///
+/// \return Unexecuted tasks (in no particular order)
+std::vector<dsn::task> ThreadPool::shutdown_now()
+{
+    begin_stop(true);
+    join_workers();
+    return take_queued();
+}
+
+/// \brief Discard the timers and stop accepting new tasks
+///
+/// Sets \a m_stop under \a queue_mutex, so every submission either sees it while queueing its task or
+/// is accounted for in \a m_pending before the workers check whether they may exit.
+///
+/// \param abort Let the workers exit without draining the queues
+void ThreadPool::begin_stop(bool abort)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_timers->mutex);
+        m_timers->stop = true;
+    }
+    m_timers->condition.notify_all();
+    if (m_timers->thread.joinable()) {
+        m_timers->thread.join();
+    }
+
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
         m_stop = true;
+        if (abort) {
+            m_abort = true;
+        }
     }
 
     condition.notify_all();
+    m_not_full.notify_all();
+}
 
+/// \brief Wait for all worker threads to exit
+void ThreadPool::join_workers()
+{
     for (auto& worker : workers) {
-        worker.join();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        retired.swap(m_retired);
+    }
+    join_all(retired);
+}
+
+/// \brief Remove all tasks from the pool's queues
+///
+/// \note Only call this after the workers have exited.
+std::vector<dsn::task> ThreadPool::take_queued()
+{
+    std::vector<dsn::task> tasks;
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    dsn::task task;
+    while (m_injection && m_injection->pop(task)) {
+        tasks.push_back(std::move(task));
     }
+    for (auto& local : m_local_queues) {
+        std::lock_guard<std::mutex> local_lock(local->mutex);
+        for (auto& t : local->tasks) {
+            tasks.push_back(std::move(t));
+        }
+        local->tasks.clear();
+    }
+    for (auto& l : m_lanes) {
+        while (!l->tasks.empty()) {
+            tasks.push_back(std::move(l->tasks.front()));
+            l->tasks.pop();
+        }
+        std::queue<dsn::chrono::clock_type::time_point>().swap(l->enqueued);
+        l->depth = 0;
+    }
+    m_queued = 0;
+    m_pending = 0;
+    return tasks;
 }
 
 /// \brief Get number of worker threads in this pool
-size_t ThreadPool::num_workers() const { return workers.size(); }
+size_t ThreadPool::num_workers() const { return m_num_workers; }
+
+/// \brief Get number of workers an elastic pool never shrinks below
+size_t ThreadPool::min_workers() const { return m_min_workers; }
+
+/// \brief Get number of workers an elastic pool never grows beyond
+///
+/// Compensating workers of \a blocking() regions come on top of this.
+size_t ThreadPool::max_workers() const { return m_elastic_slots; }
+
+/// \brief Get number of worker slots including the ones reserved for compensating workers
+size_t ThreadPool::worker_slots() const { return workers.size(); }
 
 /// \brief Check whether thread is currently idle
-bool ThreadPool::idle() const { return (m_idle_workers.load() == workers.size()); }
+///
+/// \return true if no tasks are queued and all workers are waiting for work
+bool ThreadPool::idle() const { return m_pending.load() == 0 && m_idle_workers.load() == m_num_workers.load(); }
 
 /// \brief Get number of currently idle workers
 size_t ThreadPool::idle_count() const { return m_idle_workers; }
+
+/// \brief Check whether the calling thread is one of this pool's workers
+bool ThreadPool::is_worker_thread() const { return t_current_pool == this; }
+
+const size_t ThreadPool::no_worker;
+
+/// \brief Get the index of the calling worker
+///
+/// Indices are stable for the lifetime of a worker and less than \a worker_slots(), so tasks can use
+/// them to address per-worker data without synchronization.
+///
+/// \return Index of the calling worker or \a no_worker if the calling thread isn't a worker of this pool
+size_t ThreadPool::worker_index() const { return t_current_pool == this ? t_current_index : no_worker; }
+
+/// \brief Attach a context object to the calling worker
+///
+/// Meant to be called from \a thread_pool_options::on_worker_start to build expensive per-thread state
+/// (scratch buffers, allocators, RNGs, ...) once per worker. The context is released when the worker
+/// exits.
+///
+/// \param context Context object; retrieve it with \a worker_context()
+///
+/// \throw dsn::Exception if the calling thread isn't a worker of this pool
+void ThreadPool::set_worker_context(std::shared_ptr<void> context)
+{
+    if (t_current_pool != this) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("Worker context can only be set by a worker of this ThreadPool!");
+    }
+    m_worker_contexts[t_current_index] = std::move(context);
+}
+
+/// \brief Get the context of the calling worker (\p nullptr if there is none)
+void* ThreadPool::current_context() const
+{
+    return t_current_pool == this ? m_worker_contexts[t_current_index].get() : nullptr;
+}
+
+/// \brief Execute one queued task on the calling worker
+///
+/// Lets a worker that waits for other tasks of its pool make progress instead of blocking (and
+/// possibly deadlocking the pool when all workers wait).
+///
+/// \return true if a task was executed, false if nothing was queued or the calling thread isn't a worker
+///     of this pool
+bool ThreadPool::run_pending_task()
+{
+    if (t_current_pool != this) {
+        return false;
+    }
+
+    dsn::task task;
+    if (!try_pop(t_current_index, task)) {
+        return false;
+    }
+
+    m_pending--;
+    task();
+    return true;
+}
+
+/// \brief Check whether this pool uses the work-stealing scheduler
+bool ThreadPool::work_stealing() const { return m_work_stealing; }
+
+/// \brief Get number of priority levels
+size_t ThreadPool::priority_levels() const { return m_levels; }
+
+/// \brief Get number of tasks waiting at a priority level
+///
+/// \param level Priority level (0 = highest)
+///
+/// \return Number of queued tasks at \a level (summed over all nodes) or 0 if the level doesn't exist
+size_t ThreadPool::queue_depth(size_t level) const
+{
+    size_t depth{ 0 };
+    if (level < m_levels) {
+        for (size_t n = 0; n < m_nodes.size(); ++n) {
+            depth += m_lanes[n * m_levels + level]->depth.load();
+        }
+    }
+    return depth;
+}
+
+/// \brief Get number of NUMA nodes the workers are distributed across
+///
+/// \return Number of nodes (1 unless the pool was created with \a thread_pool_options::numa_aware)
+size_t ThreadPool::num_nodes() const { return m_nodes.size(); }
+
+/// \brief Get number of worker threads on a NUMA node
+///
+/// \param node Node index
+size_t ThreadPool::num_workers(size_t node) const { return node < m_nodes.size() ? m_nodes[node]->workers.load() : 0; }
+
+/// \brief Get number of currently idle workers on a NUMA node
+///
+/// \param node Node index
+size_t ThreadPool::idle_count(size_t node) const { return node < m_nodes.size() ? m_nodes[node]->idle.load() : 0; }
+
+/// \brief Get maximum number of tasks in the shared queues
+///
+/// \return Queue capacity or 0 for an unbounded pool
+size_t ThreadPool::queue_capacity() const { return m_capacity; }
+
+/// \brief Get the data structure that is actually used for the shared queue
+///
+/// This is \a queue_policy::locked if the pool was configured for \a queue_policy::lock_free but doesn't
+/// meet its requirements.
+queue_policy ThreadPool::queue_mode() const { return m_injection ? queue_policy::lock_free : queue_policy::locked; }
+
+/// \brief Check whether the library was built with metrics support (\p WITH_THREADPOOL_METRICS)
+bool ThreadPool::metrics_supported()
+{
+#ifdef WITH_THREADPOOL_METRICS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// \brief Start or stop collecting metrics
+///
+/// Only tasks submitted while metrics are enabled are timed and counted. Timing costs two clock reads
+/// per task and wraps each task into another \p dsn::task (which usually doesn't fit inline anymore).
+///
+/// \param enable true to start collecting metrics
+///
+/// \return true if metrics are collected now (always false without \p WITH_THREADPOOL_METRICS)
+bool ThreadPool::enable_metrics(bool enable)
+{
+    m_metrics_enabled = enable && metrics_supported();
+    return m_metrics_enabled;
+}
+
+/// \brief Check whether metrics are being collected
+bool ThreadPool::metrics_enabled() const { return metrics_on(); }
+
+/// \brief Get a snapshot of the pool's metrics
+///
+/// Reading doesn't take any locks; counters updated concurrently may be slightly out of sync with each
+/// other. Busy ratios are relative to the time since construction or the last \a reset_metrics().
+thread_pool_metrics ThreadPool::metrics() const
+{
+    thread_pool_metrics result;
+    result.queue_depth = m_pending.load(std::memory_order_relaxed);
+    result.peak_queue_depth = std::max(m_metrics->peak_depth.load(std::memory_order_relaxed), result.queue_depth);
+    result.submitted = m_metrics->submitted.load(std::memory_order_relaxed);
+    result.completed = m_metrics->completed.load(std::memory_order_relaxed);
+    m_metrics->queue_wait.read(result.queue_wait);
+    m_metrics->execution_time.read(result.execution_time);
+
+    const auto since
+        = dsn::chrono::clock_type::time_point(dsn::chrono::clock_type::duration(m_metrics->since.load(std::memory_order_relaxed)));
+    const double period = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(dsn::chrono::clock_type::now() - since).count());
+    for (size_t i = 0; i < m_metrics->num_workers; ++i) {
+        const double busy = static_cast<double>(m_metrics->workers[i].busy_ns.load(std::memory_order_relaxed));
+        result.busy_ratio.push_back(period > 0 ? std::min(busy / period, 1.0) : 0.0);
+    }
+    return result;
+}
+
+/// \brief Reset all counters and start a new measurement period
+void ThreadPool::reset_metrics() { m_metrics->reset(m_pending.load()); }
+
+/// \brief Check whether new tasks shall be timed and counted
+bool ThreadPool::metrics_on() const { return metrics_supported() && m_metrics_enabled.load(std::memory_order_relaxed); }
+
+/// \brief Wrap a task for timing and count its submission
+dsn::task ThreadPool::timed(dsn::task&& task)
+{
+    m_metrics->submitted.fetch_add(1, std::memory_order_relaxed);
+    return dsn::task(timed_task(this, std::move(task)));
+}
+
+/// \brief Wrap a task so that cancelling \a token completes it right away
+///
+/// \param task Task that honours \a token when it runs (see \a wrap() and \a package())
+/// \param token Cancellation token of the task
+/// \param slot Receives the state shared with the cancel callback; set its \p pool once the task is in a
+///     bounded queue
+dsn::task ThreadPool::guard(dsn::task&& task, const cancellation_token& token, std::shared_ptr<cancel_slot>& slot)
+{
+    slot = std::make_shared<cancel_slot>();
+    slot->task = std::move(task);
+
+    auto cancelled = [slot]() {
+        dsn::task task;
+        {
+            std::lock_guard<std::mutex> lock(slot->mutex);
+            task = std::move(slot->task);
+            if (!task) {
+                // a worker has already started the task
+                return;
+            }
+            if (ThreadPool* pool = slot->pool.load()) {
+                std::lock_guard<std::mutex> queue_lock(pool->queue_mutex);
+                pool->m_cancelled++;
+                slot->released = true;
+                if (pool->m_blocked_producers > 0) {
+                    pool->m_not_full.notify_one();
+                }
+            }
+        }
+        // completes the task (and its future) as cancelled without running the user's function
+        task();
+    };
+    slot->registration = token.on_cancel(cancelled);
+    return dsn::task(cancellable_task(slot));
+}
+
+/// \brief Update the peak queue depth after tasks were queued
+void ThreadPool::note_depth()
+{
+    if (!metrics_on()) {
+        return;
+    }
+
+    const size_t depth = m_pending.load(std::memory_order_relaxed);
+    size_t peak = m_metrics->peak_depth.load(std::memory_order_relaxed);
+    while (depth > peak && !m_metrics->peak_depth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+    }
+}
+
+/// \brief Pick the node for a task
+///
+/// \param options Per-task parameters
+///
+/// \return Node from the task's hint, the submitting worker's node or the next node round-robin
+size_t ThreadPool::node_for(const task_options& options)
+{
+    if (m_nodes.size() == 1) {
+        return 0;
+    }
+    if (options.node >= 0) {
+        return static_cast<size_t>(options.node) % m_nodes.size();
+    }
+    if (t_current_pool == this) {
+        return m_slot_nodes[t_current_index];
+    }
+    return m_next_node++ % m_nodes.size();
+}
+
+/// \brief Get the shared queue for a task
+///
+/// \param node Node the task is meant for
+/// \param options Per-task parameters
+ThreadPool::lane& ThreadPool::lane_for(size_t node, const task_options& options)
+{
+    return *m_lanes[node * m_levels + std::min<size_t>(options.priority, m_levels - 1)];
+}
+
+/// \brief Queue a task for execution
+///
+/// In work-stealing mode top priority tasks submitted from one of this pool's workers for its own node
+/// are pushed onto that worker's local deque without touching \a queue_mutex; everything else goes to
+/// the shared queue for its node and priority level.
+///
+/// \param task Task that shall be executed by one of the workers
+/// \param options Per-task parameters
+/// \param may_fail Return false instead of applying the overflow policy if the queue is full
+///
+/// \return true if the task was queued (or run on the calling thread)
+///
+/// \throw dsn::Exception if the queue is full, \a may_fail is false and the policy is \a overflow_policy::reject
+bool ThreadPool::push(dsn::task&& task, const task_options& options, bool may_fail)
+{
+    if (m_stop) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot submit tasks to stopped ThreadPool!");
+    }
+
+    std::shared_ptr<cancel_slot> slot;
+    if (options.token.can_be_cancelled()) {
+        task = guard(std::move(task), options.token, slot);
+    }
+
+    if (metrics_on()) {
+        task = timed(std::move(task));
+    }
+
+    const size_t node = node_for(options);
+    auto& target = lane_for(node, options);
+    if (m_work_stealing && t_current_pool == this && m_slot_nodes[t_current_index] == node
+        && &target == m_lanes[node * m_levels].get()) {
+        auto& local = *m_local_queues[t_current_index];
+        {
+            std::lock_guard<std::mutex> lock(local.mutex);
+            local.tasks.push_back(std::move(task));
+        }
+        target.depth++;
+        m_pending++;
+        note_depth();
+        notify_one();
+        return true;
+    }
+
+    if (m_injection) {
+        // count the task before checking for stop() so that workers don't exit while it's on its way
+        m_pending++;
+        if (!m_stop && m_injection->push(task)) {
+            m_lanes[0]->depth++;
+            note_depth();
+            notify_one();
+            return true;
+        }
+        // the pool is stopping or the ring is full; the locked queue decides
+        m_pending--;
+    }
+
+    admission result;
+    // tasks dropped to make room are destroyed after unlocking since their destructors may call back into the pool
+    std::vector<dsn::task> evicted;
+    std::vector<std::thread> retired;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        result = admit(lock, target, task, may_fail, evicted);
+        if (slot && result == admission::queued && m_capacity != 0) {
+            slot->pool = this;
+        }
+        retired.swap(m_retired);
+    }
+    evicted.clear();
+    join_all(retired);
+
+    switch (result) {
+    case admission::queued:
+        if (m_spinning.load() == 0 && m_sleeping.load() > 0) {
+            condition.notify_one();
+        }
+        return true;
+
+    case admission::caller_runs:
+        task();
+        return true;
+
+    case admission::stopped:
+        DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot submit tasks to stopped ThreadPool!");
+
+    case admission::rejected:
+        break;
+    }
+
+    if (!may_fail) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("ThreadPool queue is full!");
+    }
+    return false;
+}
+
+/// \brief Queue a batch of tasks for execution
+///
+/// Same as \a push() for each task but with a single lock acquisition for the whole batch.
+///
+/// \param batch Array of tasks that shall be executed; the tasks are moved out of it
+/// \param count Number of tasks in \a batch
+/// \param options Per-task parameters applied to every task of the batch
+void ThreadPool::push_bulk(dsn::task* batch, size_t count, const task_options& options)
+{
+    if (count == 0) {
+        return;
+    }
+
+    if (m_stop) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot submit tasks to stopped ThreadPool!");
+    }
+
+    std::vector<std::shared_ptr<cancel_slot> > slots;
+    if (options.token.can_be_cancelled()) {
+        slots.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            batch[i] = guard(std::move(batch[i]), options.token, slots[i]);
+        }
+    }
+
+    if (metrics_on()) {
+        for (size_t i = 0; i < count; ++i) {
+            batch[i] = timed(std::move(batch[i]));
+        }
+    }
+
+    const size_t node = node_for(options);
+    auto& target = lane_for(node, options);
+    if (m_work_stealing && t_current_pool == this && m_slot_nodes[t_current_index] == node
+        && &target == m_lanes[node * m_levels].get()) {
+        auto& local = *m_local_queues[t_current_index];
+        {
+            std::lock_guard<std::mutex> lock(local.mutex);
+            for (size_t i = 0; i < count; ++i) {
+                local.tasks.push_back(std::move(batch[i]));
+            }
+        }
+        target.depth += count;
+        m_pending += count;
+        note_depth();
+        notify(count);
+        return;
+    }
+
+    if (m_injection) {
+        // see push() for why the tasks are counted first
+        m_pending += count;
+        size_t injected{ 0 };
+        while (!m_stop && injected < count && m_injection->push(batch[injected])) {
+            injected++;
+        }
+        m_lanes[0]->depth += injected;
+        m_pending -= count - injected;
+        note_depth();
+        notify(injected);
+        if (injected == count) {
+            return;
+        }
+        // the ring is full; the rest goes to the locked queue
+        batch += injected;
+        count -= injected;
+        if (!slots.empty()) {
+            slots.erase(slots.begin(), slots.begin() + injected);
+        }
+    }
+
+    size_t queued{ 0 };
+    bool rejected{ false };
+    bool stopped{ false };
+    std::vector<dsn::task> inline_tasks;
+    std::vector<dsn::task> evicted;
+    std::vector<std::thread> retired;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        for (size_t i = 0; i < count && !rejected && !stopped; ++i) {
+            switch (admit(lock, target, batch[i], false, evicted)) {
+            case admission::queued:
+                if (!slots.empty() && m_capacity != 0) {
+                    slots[i]->pool = this;
+                }
+                queued++;
+                break;
+            case admission::caller_runs:
+                inline_tasks.push_back(std::move(batch[i]));
+                break;
+            case admission::rejected:
+                rejected = true;
+                break;
+            case admission::stopped:
+                stopped = true;
+                break;
+            }
+        }
+        retired.swap(m_retired);
+    }
+    notify(queued);
+    evicted.clear();
+    join_all(retired);
+
+    for (auto& task : inline_tasks) {
+        task();
+    }
+
+    if (stopped) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot submit tasks to stopped ThreadPool!");
+    }
+    if (rejected) {
+        DSN_DEFAULT_EXCEPTION_SIMPLE("ThreadPool queue is full!");
+    }
+}
+
+/// \brief Get the number of queued tasks that count toward \a m_capacity
+///
+/// Cancelled tasks are left out. A cancelled task that a worker has just dequeued but not yet started may
+/// still be subtracted, so a bounded queue can briefly hold one task more than its capacity per worker.
+///
+/// \note Requires \a queue_mutex to be held by the caller
+size_t ThreadPool::queued_load() const { return m_queued - std::min(m_cancelled, m_queued); }
+
+/// \brief Put a task into a shared queue, applying the overflow policy if it is full
+///
+/// \note Requires \a lock to hold \a queue_mutex; it may be released temporarily while waiting for room.
+///
+/// \param lock Lock on \a queue_mutex
+/// \param target Queue for the task's priority level
+/// \param task Task to queue; left untouched unless the result is \a admission::queued
+/// \param may_fail Reject the task if the queue is full instead of applying the overflow policy
+/// \param evicted Receives the tasks discarded by \a overflow_policy::drop_oldest; the caller has to destroy
+///     them after releasing \a lock
+///
+/// \return Whether the task was queued, rejected (because the queue is full or the pool is stopped) or has
+///     to be run by the caller
+ThreadPool::admission ThreadPool::admit(std::unique_lock<std::mutex>& lock, lane& target, dsn::task& task,
+    bool may_fail, std::vector<dsn::task>& evicted)
+{
+    if (m_stop) {
+        return admission::stopped;
+    }
+
+    if (m_capacity != 0 && queued_load() >= m_capacity) {
+        if (may_fail) {
+            return admission::rejected;
+        }
+
+        switch (m_overflow) {
+        case overflow_policy::block:
+            // a worker waiting for room in its own pool could deadlock it
+            if (t_current_pool == this) {
+                return admission::caller_runs;
+            }
+            m_blocked_producers++;
+            while (queued_load() >= m_capacity && !m_stop) {
+                m_not_full.wait(lock);
+            }
+            m_blocked_producers--;
+            if (m_stop) {
+                return admission::stopped;
+            }
+            break;
+
+        case overflow_policy::reject:
+            return admission::rejected;
+
+        case overflow_policy::caller_runs:
+            return admission::caller_runs;
+
+        case overflow_policy::drop_oldest:
+            for (size_t level = m_levels; level-- > 0 && queued_load() >= m_capacity;) {
+                for (size_t n = 0; n < m_nodes.size(); ++n) {
+                    lane& victim = *m_lanes[n * m_levels + level];
+                    if (!victim.tasks.empty()) {
+                        evicted.push_back(std::move(victim.tasks.front()));
+                        victim.tasks.pop();
+                        if (!victim.enqueued.empty()) {
+                            victim.enqueued.pop();
+                        }
+                        victim.depth--;
+                        m_queued--;
+                        m_pending--;
+                        break;
+                    }
+                }
+            }
+            break;
+        }
+    }
+
+    target.tasks.push(std::move(task));
+    if (m_elastic_slots > m_min_workers) {
+        target.enqueued.push(dsn::chrono::clock_type::now());
+        arm_growth_check();
+    }
+    target.depth++;
+    m_queued++;
+    m_pending++;
+    note_depth();
+    maybe_grow();
+    return admission::queued;
+}
+
+/// \brief Start an additional worker if an elastic pool can't keep up with its queue
+///
+/// This is checked both on submission and whenever a worker dequeues a task, so a burst that was
+/// submitted at once still grows the pool while it is being worked off.
+///
+/// \note Requires \a queue_mutex to be held by the caller
+void ThreadPool::maybe_grow()
+{
+    if (m_num_workers - m_retiring - m_compensating >= m_elastic_slots || m_sleeping.load() > 0
+        || m_spinning.load() > 0 || m_stop) {
+        return;
+    }
+
+    const auto now = dsn::chrono::clock_type::now();
+    bool waiting{ false };
+    for (auto& l : m_lanes) {
+        if (!l->enqueued.empty() && now - l->enqueued.front() >= m_grow_threshold) {
+            waiting = true;
+            break;
+        }
+    }
+    if (!waiting) {
+        return;
+    }
+
+    for (size_t i = 0; i < m_elastic_slots; ++i) {
+        if (!m_active_slots[i]) {
+            spawn_worker(i);
+            return;
+        }
+    }
+}
+
+/// \brief Let the timer thread check for growth once the queued tasks waited for \a m_grow_threshold
+///
+/// Submissions and dequeues only notice waiting tasks while they happen; this covers elastic pools whose
+/// workers are all stuck in long tasks while nobody submits anything.
+///
+/// \note Requires \a queue_mutex to be held by the caller
+void ThreadPool::arm_growth_check()
+{
+    if (m_grow_armed || m_num_workers - m_retiring - m_compensating >= m_elastic_slots) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_timers->mutex);
+    if (m_timers->stop) {
+        return;
+    }
+    m_grow_armed = true;
+    m_timers->grow_check = dsn::chrono::clock_type::now() + m_grow_threshold;
+    if (!m_timers->thread.joinable()) {
+        m_timers->thread = std::thread([this] { timer_main(); });
+    }
+    m_timers->condition.notify_one();
+}
+
+/// \brief Growth check scheduled by \a arm_growth_check(), run by the timer thread
+void ThreadPool::check_growth()
+{
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        m_grow_armed = false;
+        maybe_grow();
+        if (m_queued > 0) {
+            arm_growth_check();
+        }
+        retired.swap(m_retired);
+    }
+    join_all(retired);
+}
+
+/// \brief Start a worker thread in a free slot
+///
+/// \note Requires \a queue_mutex to be held by the caller
+///
+/// \param index Index of the slot in \a workers
+void ThreadPool::spawn_worker(size_t index)
+{
+    // a retired worker frees its slot as the last thing it does under the lock; its thread is joined by
+    // whoever releases the lock next
+    if (workers[index].joinable()) {
+        m_retired.push_back(std::move(workers[index]));
+    }
+
+    m_active_slots[index] = true;
+    m_num_workers++;
+    m_nodes[m_slot_nodes[index]]->workers++;
+    workers[index] = std::thread([this, index] { worker_main(index); });
+}
+
+/// \brief Wake up as many sleeping workers as needed for \a count new tasks
+///
+/// \see notify_one
+void ThreadPool::notify(size_t count)
+{
+    const size_t spinning = m_spinning.load();
+    const size_t sleeping = m_sleeping.load();
+    if (sleeping == 0 || spinning >= count) {
+        return;
+    }
+    count -= spinning;
+
+    { std::lock_guard<std::mutex> lock(queue_mutex); }
+    if (count >= sleeping) {
+        condition.notify_all();
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        condition.notify_one();
+    }
+}
+
+/// \brief Wake up a sleeping worker if there is one
+///
+/// \note \a m_pending must have been incremented before calling this. Workers bump \a m_sleeping
+/// before re-checking \a m_pending while holding \a queue_mutex, so either the worker sees the new
+/// task or we see the sleeper. Taking the mutex makes sure the sleeper has reached \p wait().
+/// Likewise spinning workers re-check \a m_pending after leaving \a m_spinning, so nobody needs to be
+/// woken up while one of them is still spinning.
+void ThreadPool::notify_one()
+{
+    if (m_spinning.load() > 0 || m_sleeping.load() == 0) {
+        return;
+    }
+
+    { std::lock_guard<std::mutex> lock(queue_mutex); }
+    condition.notify_one();
+}
+
+/// \brief Fetch the next task for a worker
+///
+/// Checks the worker's local deque (newest first), then the shared queues (its own node's first)
+/// and finally tries to steal from the other workers.
+///
+/// \param index Index of the calling worker
+/// \param task Receives the dequeued task
+///
+/// \return true if a task was dequeued
+bool ThreadPool::try_pop(size_t index, dsn::task& task)
+{
+    if (m_work_stealing) {
+        auto& local = *m_local_queues[index];
+        std::lock_guard<std::mutex> lock(local.mutex);
+        if (!local.tasks.empty()) {
+            task = std::move(local.tasks.back());
+            local.tasks.pop_back();
+            m_lanes[m_slot_nodes[index] * m_levels]->depth--;
+            return true;
+        }
+    }
+
+    if (m_injection && m_injection->pop(task)) {
+        m_lanes[0]->depth--;
+        return true;
+    }
+
+    bool popped;
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        popped = pop_lane(m_slot_nodes[index], task);
+        retired.swap(m_retired);
+    }
+    join_all(retired);
+    if (popped) {
+        return true;
+    }
+
+    return m_work_stealing && try_steal(index, task);
+}
+
+/// \brief Dequeue the next task from the shared queues according to \a m_priority_policy
+///
+/// \note Requires \a queue_mutex to be held by the caller
+///
+/// \param node Node of the calling worker; its queues are checked before the other nodes' ones
+/// \param task Receives the dequeued task
+///
+/// \return true if a task was dequeued
+bool ThreadPool::pop_lane(size_t node, dsn::task& task)
+{
+    auto take = [this, &task](lane& l) {
+        task = std::move(l.tasks.front());
+        l.tasks.pop();
+        l.depth--;
+        m_queued--;
+        if (!l.enqueued.empty()) {
+            l.enqueued.pop();
+            maybe_grow();
+        }
+        if (m_blocked_producers > 0) {
+            m_not_full.notify_one();
+        }
+    };
+
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        auto first = m_lanes.begin() + ((node + i) % m_nodes.size()) * m_levels;
+        auto last = first + m_levels;
+
+        if (m_priority_policy == priority_policy::strict) {
+            for (auto it = first; it != last; ++it) {
+                if (!(*it)->tasks.empty()) {
+                    take(**it);
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        for (int round = 0; round < 2; ++round) {
+            bool queued = false;
+            for (auto it = first; it != last; ++it) {
+                lane& l = **it;
+                if (!l.tasks.empty()) {
+                    queued = true;
+                    if (l.credits > 0) {
+                        l.credits--;
+                        take(l);
+                        return true;
+                    }
+                }
+            }
+
+            if (!queued) {
+                break;
+            }
+
+            // every non-empty level used up its share of the current round
+            for (auto it = first; it != last; ++it) {
+                (*it)->credits = (*it)->weight;
+            }
+        }
+    }
+
+    return false;
+}
+
+/// \brief Steal the oldest task from another worker's deque
+///
+/// \param index Index of the calling worker; victims are probed round-robin starting after it, workers
+/// on the same node first
+/// \param task Receives the stolen task
+///
+/// \return true if a task was stolen
+bool ThreadPool::try_steal(size_t index, dsn::task& task)
+{
+    const size_t count = m_local_queues.size();
+    const size_t node = m_slot_nodes[index];
+    for (int pass = 0; pass < (m_nodes.size() > 1 ? 2 : 1); ++pass) {
+        for (size_t i = 1; i < count; ++i) {
+            const size_t victim_index = (index + i) % count;
+            if (m_nodes.size() > 1 && (m_slot_nodes[victim_index] == node) != (pass == 0)) {
+                continue;
+            }
+
+            auto& victim = *m_local_queues[victim_index];
+            std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+            if (lock.owns_lock() && !victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                m_lanes[m_slot_nodes[victim_index] * m_levels]->depth--;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/// \brief Register a timer
+///
+/// \param when Time at which the timer fires first
+/// \param period Interval for periodic timers (zero for one-shot timers)
+/// \param once Task for one-shot timers
+/// \param repeat Callable for periodic timers
+///
+/// \return Identifier of the new timer
+ThreadPool::timer_id ThreadPool::add_timer(dsn::chrono::clock_type::time_point when,
+    dsn::chrono::clock_type::duration period, dsn::task&& once, std::shared_ptr<std::function<void()> > repeat)
+{
+    timer_id id;
+    bool earliest;
+    {
+        std::lock_guard<std::mutex> lock(m_timers->mutex);
+        if (m_timers->stop) {
+            DSN_DEFAULT_EXCEPTION_SIMPLE("Cannot schedule tasks on stopped ThreadPool!");
+        }
+
+        id = m_timers->next_id++;
+        m_timers->entries[id] = timer_queue::entry{ period, std::move(once), std::move(repeat) };
+        m_timers->heap.push_back(timer_queue::due_time{ when, id });
+        std::push_heap(m_timers->heap.begin(), m_timers->heap.end(), std::greater<timer_queue::due_time>());
+        earliest = m_timers->heap.front().id == id;
+
+        if (!m_timers->thread.joinable()) {
+            m_timers->thread = std::thread([this] { timer_main(); });
+        }
+    }
+
+    if (earliest) {
+        m_timers->condition.notify_one();
+    }
+    return id;
+}
+
+/// \brief Cancel a timer
+///
+/// One-shot timers that already fired can't be cancelled anymore. Periodic timers don't fire again
+/// after this returns but runs that were already queued still execute.
+///
+/// \param id Identifier returned by \a schedule_at(), \a schedule_after() or \a schedule_every()
+///
+/// \return true if the timer was pending
+bool ThreadPool::cancel_timer(timer_id id)
+{
+    // the timer's task is destroyed after unlocking since its destructor may schedule new timers
+    timer_queue::entry cancelled;
+    std::lock_guard<std::mutex> lock(m_timers->mutex);
+    auto it = m_timers->entries.find(id);
+    if (it == m_timers->entries.end()) {
+        return false;
+    }
+    cancelled = std::move(it->second);
+    m_timers->entries.erase(it);
+    return true;
+}
+
+/// \brief Get number of timers that haven't fired yet
+///
+/// \return Number of pending one-shot timers plus all active periodic timers
+size_t ThreadPool::pending_timers() const
+{
+    std::lock_guard<std::mutex> lock(m_timers->mutex);
+    return m_timers->entries.size();
+}
+
+/// \brief Timer thread main loop
+///
+/// Waits for the earliest timer to become due and hands the tasks of all due timers to the
+/// workers through the regular queues. Also runs the growth checks of elastic pools.
+///
+/// The tasks are queued without applying the overflow policy, so this thread never blocks on a full
+/// queue or runs a task itself. A one-shot timer that doesn't fit into a full queue is retried after
+/// \a timer_retry_delay; a periodic run that doesn't fit is skipped like a missed run.
+void ThreadPool::timer_main()
+{
+    auto& timers = *m_timers;
+    std::vector<dsn::task> due;
+    // one-shot timers of bounded pools by index in due; the queued task only refers to the timer's task
+    // so the unwrapped task can be put back if the queue is full
+    std::vector<std::pair<timer_id, std::shared_ptr<dsn::task> > > retries;
+
+    std::unique_lock<std::mutex> lock(timers.mutex);
+    while (!timers.stop) {
+        auto now = dsn::chrono::clock_type::now();
+        if (timers.grow_check <= now) {
+            timers.grow_check = dsn::chrono::clock_type::time_point::max();
+            lock.unlock();
+            check_growth();
+            lock.lock();
+            continue;
+        }
+
+        if (timers.heap.empty() || timers.heap.front().when > now) {
+            auto until = timers.grow_check;
+            if (!timers.heap.empty()) {
+                until = std::min(until, timers.heap.front().when);
+            }
+            if (until == dsn::chrono::clock_type::time_point::max()) {
+                timers.condition.wait(lock);
+            } else {
+                timers.condition.wait_until(lock, until);
+            }
+            continue;
+        }
+
+        while (!timers.heap.empty() && timers.heap.front().when <= now) {
+            auto next = timers.heap.front();
+            std::pop_heap(timers.heap.begin(), timers.heap.end(), std::greater<timer_queue::due_time>());
+            timers.heap.pop_back();
+
+            auto it = timers.entries.find(next.id);
+            if (it == timers.entries.end()) {
+                // cancelled
+                continue;
+            }
+
+            if (it->second.repeat) {
+                auto repeat = it->second.repeat;
+                due.emplace_back([repeat]() { (*repeat)(); });
+                retries.emplace_back();
+                next.when += it->second.period;
+                if (next.when <= now) {
+                    next.when = now + it->second.period;
+                }
+                timers.heap.push_back(next);
+                std::push_heap(timers.heap.begin(), timers.heap.end(), std::greater<timer_queue::due_time>());
+            } else if (m_capacity != 0) {
+                auto once = std::make_shared<dsn::task>(std::move(it->second.once));
+                due.emplace_back([once]() { (*once)(); });
+                retries.emplace_back(next.id, std::move(once));
+                timers.entries.erase(it);
+            } else {
+                due.push_back(std::move(it->second.once));
+                retries.emplace_back();
+                timers.entries.erase(it);
+            }
+        }
+
+        lock.unlock();
+        // the pool only stops after this thread has exited, so push() can't throw here
+        for (size_t i = 0; i < due.size(); ++i) {
+            if (push(std::move(due[i]), task_options(), true)) {
+                retries[i].second.reset();
+            }
+        }
+        // skipped periodic runs are destroyed here, outside the timer lock
+        due.clear();
+        lock.lock();
+
+        const auto retry = dsn::chrono::clock_type::now() + timer_retry_delay;
+        for (auto& timer : retries) {
+            if (timer.second) {
+                timers.entries[timer.first].once = std::move(*timer.second);
+                timers.heap.push_back(timer_queue::due_time{ retry, timer.first });
+                std::push_heap(timers.heap.begin(), timers.heap.end(), std::greater<timer_queue::due_time>());
+            }
+        }
+        retries.clear();
+    }
+}
+
+/// \brief Busy-wait for new tasks according to \a m_wait_strategy
+///
+/// \return true if tasks showed up before the spin phase ended
+bool ThreadPool::spin_wait()
+{
+    if (m_wait_strategy == wait_strategy::block) {
+        return false;
+    }
+
+    auto ready = [this]() {
+        return m_pending.load(std::memory_order_relaxed) != 0 || m_stop.load(std::memory_order_relaxed);
+    };
+
+    bool found{ false };
+    m_spinning++;
+    if (m_wait_strategy == wait_strategy::busy_poll) {
+        while (!ready()) {
+            cpu_relax();
+        }
+        found = true;
+    } else {
+        for (unsigned i = 0; i < m_spin_count && !found; ++i) {
+            found = ready();
+            cpu_relax();
+        }
+        if (m_wait_strategy == wait_strategy::spin_yield) {
+            for (unsigned i = 0; i < m_yield_count && !found; ++i) {
+                found = ready();
+                std::this_thread::yield();
+            }
+        }
+    }
+    m_spinning--;
+
+    // a stopping pool is handled by the blocking path of the worker loop
+    return found && !m_stop;
+}
+
+/// \brief Worker thread entry point
+///
+/// \note Exceptions escaping the \a on_worker_start or \a on_worker_stop hooks terminate the program.
+///
+/// \param index Index of this worker in \a workers
+void ThreadPool::worker_main(size_t index)
+{
+    t_current_pool = this;
+    t_current_index = index;
+    pin_current_thread(m_slot_cpus[index]);
+
+    if (m_on_worker_start) {
+        m_on_worker_start(index);
+    }
+
+    worker_loop(index);
+
+    if (m_on_worker_stop) {
+        m_on_worker_stop(index);
+    }
+    m_worker_contexts[index].reset();
+
+    // the slot may only be reused once nothing of this thread touches it anymore
+    node& self = *m_nodes[m_slot_nodes[index]];
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    m_retiring--;
+    m_active_slots[index] = false;
+    self.workers--;
+    self.idle--;
+    m_num_workers--;
+    m_idle_workers--;
+    m_exited.notify_all();
+}
+
+/// \brief Worker thread main loop
+///
+/// Returns once the worker has been counted in \a m_retiring; \a worker_main() releases its slot after
+/// running the stop hook.
+///
+/// \param index Index of this worker in \a workers
+void ThreadPool::worker_loop(size_t index)
+{
+    node& self = *m_nodes[m_slot_nodes[index]];
+    const bool compensating = index >= m_elastic_slots;
+
+    self.idle++;
+    m_idle_workers++;
+    dsn::task task;
+    bool spun{ false };
+    for (;;) {
+        // a compensating worker is surplus once the blocking region it stood in for has ended
+        if (compensating && m_compensating.load() > m_blocking.load()) {
+            std::lock_guard<std::mutex> lock(this->queue_mutex);
+            if (m_compensating > m_blocking) {
+                m_compensating--;
+                m_retiring++;
+                return;
+            }
+        }
+
+        if (!m_abort.load(std::memory_order_relaxed) && try_pop(index, task)) {
+            // idle count has to drop before pending so that idle() never sees both at rest
+            self.idle--;
+            m_idle_workers--;
+            if (m_pending-- > 1 && spun) {
+                // submitters didn't wake anybody up while we were spinning
+                notify_one();
+            }
+            spun = false;
+            task();
+            task.reset();
+            m_idle_workers++;
+            self.idle++;
+            continue;
+        }
+
+        if (spin_wait()) {
+            spun = true;
+            continue;
+        }
+
+        spun = false;
+        std::unique_lock<std::mutex> lock(this->queue_mutex);
+        m_sleeping++;
+        bool expired{ false };
+        while (!this->m_stop && m_pending.load() == 0 && !expired
+            && !(compensating && m_compensating.load() > m_blocking.load())) {
+            if (!compensating && m_elastic_slots > m_min_workers) {
+                expired = this->condition.wait_for(lock, m_keep_alive) == std::cv_status::timeout;
+            } else {
+                this->condition.wait(lock);
+            }
+        }
+        m_sleeping--;
+
+        if (this->m_stop && (m_abort || m_pending.load() == 0)) {
+            if (compensating) {
+                m_compensating--;
+            }
+            m_retiring++;
+            return;
+        }
+
+        if (expired && m_pending.load() == 0 && m_num_workers - m_retiring - m_compensating > m_min_workers) {
+            m_retiring++;
+            return;
+        }
+    }
+}
@@ -0,0 +1,207 @@
+#define BOOST_TEST_MODULE "dsn::cancellation"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <dsnutil/cancellation.h>
+#include <dsnutil/pool_future.h>
+#include <dsnutil/task_group.h>
+#include <dsnutil/threadpool.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+/// \brief Occupy the only worker of \a pool until the returned promise is fulfilled
+std::shared_ptr<std::promise<void> > block_worker(dsn::ThreadPool& pool)
+{
+    auto gate = std::make_shared<std::promise<void> >();
+    std::shared_future<void> open(gate->get_future());
+    std::promise<void> started;
+    auto running = started.get_future();
+    pool.post([open, &started]() {
+        started.set_value();
+        open.wait();
+    });
+    running.wait();
+    return gate;
+}
+}
+
+BOOST_AUTO_TEST_CASE(tokens)
+{
+    dsn::cancellation_token none;
+    BOOST_CHECK(!none.can_be_cancelled());
+    BOOST_CHECK(!none.is_cancelled());
+    BOOST_CHECK_NO_THROW(none.throw_if_cancelled());
+
+    dsn::cancellation_source source;
+    auto token = source.token();
+    auto copy = source;
+    BOOST_CHECK(token.can_be_cancelled());
+    BOOST_CHECK(!token.is_cancelled());
+
+    copy.cancel();
+    BOOST_CHECK(source.is_cancelled());
+    BOOST_CHECK(token.is_cancelled());
+    BOOST_CHECK_THROW(token.throw_if_cancelled(), dsn::task_cancelled);
+    BOOST_CHECK_THROW(token.throw_if_cancelled(), dsn::Exception);
+}
+
+BOOST_AUTO_TEST_CASE(queued_tasks_are_dropped)
+{
+    dsn::ThreadPool pool(1);
+    auto gate = block_worker(pool);
+
+    dsn::cancellation_source source;
+    dsn::task_options options;
+    options.token = source.token();
+
+    std::atomic<size_t> ran{ 0 };
+    auto future = pool.enqueue(options, [&ran]() { return ++ran; });
+    pool.post(options, [&ran]() { ran++; });
+    std::vector<std::function<void()> > batch(10, [&ran]() { ran++; });
+    pool.post_bulk(batch.begin(), batch.end(), options);
+    auto bulk = pool.enqueue_bulk(batch.begin(), batch.end(), options);
+    auto other = pool.enqueue([&ran]() { return ran.load(); });
+
+    source.cancel();
+    gate->set_value();
+
+    BOOST_CHECK_THROW(future.get(), dsn::task_cancelled);
+    for (auto& f : bulk) {
+        BOOST_CHECK_THROW(f.get(), dsn::task_cancelled);
+    }
+    BOOST_CHECK(other.get() == 0);
+    BOOST_CHECK(ran == 0);
+}
+
+BOOST_AUTO_TEST_CASE(futures_complete_on_cancel)
+{
+    dsn::ThreadPool pool(1);
+    auto gate = block_worker(pool);
+
+    dsn::cancellation_source source;
+    dsn::task_options options;
+    options.token = source.token();
+
+    auto future = pool.enqueue(options, []() { return 1; });
+    auto async = dsn::async(pool, options, []() { return 2; });
+    dsn::task_group group(pool);
+    group.run(options, []() {});
+    source.cancel();
+
+    // the head task is still running, so nothing has been dequeued yet
+    BOOST_CHECK(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    BOOST_CHECK_THROW(future.get(), dsn::task_cancelled);
+    BOOST_CHECK(async.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    BOOST_CHECK(async.is_cancelled());
+    BOOST_CHECK(group.wait_for(std::chrono::seconds(0)));
+
+    gate->set_value();
+}
+
+BOOST_AUTO_TEST_CASE(cancelled_tasks_release_capacity)
+{
+    dsn::thread_pool_options pool_options;
+    pool_options.num_threads = 1;
+    pool_options.queue_capacity = 1;
+    pool_options.overflow = dsn::overflow_policy::block;
+    dsn::ThreadPool pool(pool_options);
+    auto gate = block_worker(pool);
+
+    dsn::cancellation_source source;
+    dsn::task_options options;
+    options.token = source.token();
+    pool.post(options, []() {});
+
+    // the queue is full, so this producer blocks until the cancelled task stops counting
+    std::atomic<bool> ran{ false };
+    auto producer = std::async(std::launch::async, [&pool, &ran]() { pool.post([&ran]() { ran = true; }); });
+    BOOST_CHECK(producer.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+
+    source.cancel();
+    BOOST_CHECK(producer.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    BOOST_CHECK(!ran);
+
+    gate->set_value();
+    producer.get();
+    pool.stop();
+    BOOST_CHECK(ran);
+}
+
+BOOST_AUTO_TEST_CASE(running_tasks_poll)
+{
+    dsn::ThreadPool pool(2);
+    dsn::cancellation_source source;
+    auto token = source.token();
+
+    std::promise<void> started;
+    auto running = started.get_future();
+    auto future = pool.enqueue([token, &started]() {
+        started.set_value();
+        size_t iterations{ 0 };
+        while (!token.is_cancelled()) {
+            iterations++;
+            std::this_thread::yield();
+        }
+        return iterations;
+    });
+
+    running.wait();
+    source.cancel();
+    BOOST_CHECK(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+}
+
+BOOST_AUTO_TEST_CASE(pool_future_cancelled)
+{
+    dsn::ThreadPool pool(1);
+    auto gate = block_worker(pool);
+
+    dsn::cancellation_source source;
+    dsn::task_options options;
+    options.token = source.token();
+
+    auto cancelled = dsn::async(pool, options, []() { return 1; });
+    auto kept = dsn::async(pool, []() { return 2; });
+    auto failed = dsn::async(pool, []() -> int { throw std::runtime_error("failed"); });
+    source.cancel();
+    gate->set_value();
+
+    cancelled.wait();
+    BOOST_CHECK(cancelled.is_cancelled());
+    BOOST_CHECK_THROW(cancelled.get(), dsn::task_cancelled);
+
+    kept.wait();
+    BOOST_CHECK(!kept.is_cancelled());
+    BOOST_CHECK(kept.get() == 2);
+
+    failed.wait();
+    BOOST_CHECK(!failed.is_cancelled());
+}
+
+BOOST_AUTO_TEST_CASE(task_group_cancelled)
+{
+    dsn::ThreadPool pool(1);
+    auto gate = block_worker(pool);
+
+    dsn::cancellation_source source;
+    dsn::task_options options;
+    options.token = source.token();
+
+    dsn::task_group group(pool);
+    std::atomic<size_t> ran{ 0 };
+    for (size_t i = 0; i < 10; ++i) {
+        group.run(options, [&ran]() { ran++; });
+    }
+    source.cancel();
+    gate->set_value();
+
+    BOOST_CHECK(group.wait_for(std::chrono::seconds(10)));
+    BOOST_CHECK(ran == 0);
+}
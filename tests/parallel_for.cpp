@@ -1,11 +1,18 @@
 #define BOOST_TEST_MODULE "dsn::parallel_for"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
 #include <dsnutil/parallel_for.h>
+#include <dsnutil/threadpool.h>
 
 #include <boost/math/constants/constants.hpp>
 #include <boost/test/unit_test.hpp>
@@ -33,3 +40,180 @@ BOOST_AUTO_TEST_CASE(parallel_for)
     auto parallel_time = duration_cast<milliseconds>(parallel_end - parallel_start).count();
     std::cout << "parallel_for loop execution finished in " << parallel_time << "ms" << std::endl;
 }
+
+BOOST_AUTO_TEST_CASE(parallel_for_on_pool)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 10000 };
+    std::unique_ptr<std::atomic<unsigned>[]> visits(new std::atomic<unsigned>[size]);
+    for (size_t i = 0; i < size; ++i) {
+        visits[i] = 0;
+    }
+
+    dsn::parallel_for(pool, size, [&](size_t index) { visits[index]++; });
+    for (size_t i = 0; i < size; ++i) {
+        BOOST_CHECK(visits[i] == 1);
+    }
+
+    // repeated small loops reuse the pool's workers
+    const size_t rounds{ 1000 };
+    std::atomic<size_t> total{ 0 };
+    TimePoint start = Clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        dsn::parallel_for(pool, 64, [&](size_t) { total++; });
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    std::cout << rounds << " parallel_for loops on a pool took " << elapsed / rounds << "us each" << std::endl;
+    BOOST_CHECK(total == rounds * 64);
+
+    dsn::parallel_for(pool, 0, [](size_t) { BOOST_FAIL("empty loop must not call func"); });
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_nested)
+{
+    dsn::ThreadPool pool(1);
+    std::atomic<size_t> total{ 0 };
+
+    // the only worker runs the outer task and does the inner loop itself
+    auto result = pool.enqueue([&]() { dsn::parallel_for(pool, 1000, [&](size_t) { total++; }); });
+    BOOST_REQUIRE(result.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    result.get();
+    BOOST_CHECK(total == 1000);
+
+    // a stopped pool leaves all the work to the caller
+    pool.stop();
+    dsn::parallel_for(pool, 100, [&](size_t) { total++; });
+    BOOST_CHECK(total == 1100);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_exceptions)
+{
+    dsn::ThreadPool pool(4);
+    std::atomic<size_t> calls{ 0 };
+    BOOST_CHECK_THROW(dsn::parallel_for(pool, 100000,
+                          [&](size_t index) {
+                              calls++;
+                              if (index == 500) {
+                                  throw std::runtime_error("failed");
+                              }
+                          }),
+        std::runtime_error);
+    BOOST_CHECK(calls < 100000);
+
+    // the shared pool behaves the same
+    BOOST_CHECK_THROW(
+        dsn::parallel_for(10, [](size_t) { throw std::runtime_error("failed"); }), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_schedules)
+{
+    dsn::ThreadPool pool(3);
+    const size_t size{ 10007 };
+    for (auto schedule : { dsn::loop_schedule::fixed, dsn::loop_schedule::dynamic, dsn::loop_schedule::guided }) {
+        for (size_t grain : { 0, 1, 7, 64, 20000 }) {
+            dsn::loop_options options;
+            options.schedule = schedule;
+            options.grain = grain;
+
+            std::unique_ptr<std::atomic<unsigned>[]> visits(new std::atomic<unsigned>[size]);
+            std::unique_ptr<std::thread::id[]> owner(new std::thread::id[size]);
+            for (size_t i = 0; i < size; ++i) {
+                visits[i] = 0;
+            }
+            dsn::parallel_for(pool, size,
+                [&](size_t index) {
+                    visits[index]++;
+                    owner[index] = std::this_thread::get_id();
+                },
+                options);
+
+            for (size_t i = 0; i < size; ++i) {
+                BOOST_CHECK(visits[i] == 1);
+            }
+
+            // chunks are contiguous and run by a single thread
+            if (grain > 1 && schedule != dsn::loop_schedule::guided) {
+                for (size_t i = 0; i < size; ++i) {
+                    BOOST_CHECK(owner[i] == owner[i - i % grain]);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_irregular_costs)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 2000 };
+    for (auto schedule : { dsn::loop_schedule::fixed, dsn::loop_schedule::dynamic, dsn::loop_schedule::guided }) {
+        dsn::loop_options options;
+        options.schedule = schedule;
+        std::atomic<size_t> total{ 0 };
+
+        // iteration cost grows with the index
+        TimePoint start = Clock::now();
+        dsn::parallel_for(pool, size,
+            [&](size_t index) {
+                double x{ 0.0 };
+                for (size_t k = 0; k < index; ++k) {
+                    x += std::sin(static_cast<double>(k));
+                }
+                total += x != 12345.0;
+            },
+            options);
+        auto elapsed = duration_cast<milliseconds>(Clock::now() - start).count();
+        std::cout << "triangular loop with schedule " << static_cast<int>(schedule) << ": " << elapsed << "ms"
+                  << std::endl;
+        BOOST_CHECK(total == size);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_templates)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 1 << 20 };
+    std::vector<float> a(size, 1.0f), b(size, 2.0f), c(size, 0.0f);
+
+    // range bodies see each index exactly once, in contiguous chunks
+    std::atomic<size_t> covered{ 0 };
+    std::atomic<size_t> bad_ranges{ 0 };
+    dsn::parallel_for(pool, size, [&](size_t begin, size_t end) {
+        if (!(begin < end && end <= size)) {
+            bad_ranges++;
+            return;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            c[i] = a[i] + b[i];
+        }
+        covered += end - begin;
+    });
+    BOOST_CHECK(bad_ranges == 0);
+    BOOST_CHECK(covered == size);
+    BOOST_CHECK(std::all_of(c.begin(), c.end(), [](float x) { return x == 3.0f; }));
+
+    // the per-index body is inlined, std::function still works for callers that have one
+    const size_t rounds{ 20 };
+    std::function<void(const size_t)> erased = [&](size_t i) { c[i] = a[i] * b[i]; };
+    TimePoint start = Clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        dsn::parallel_for(pool, size, erased);
+    }
+    auto erased_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    BOOST_CHECK(std::all_of(c.begin(), c.end(), [](float x) { return x == 2.0f; }));
+
+    start = Clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        dsn::parallel_for(pool, size, [&](size_t i) { c[i] = a[i] + a[i] * b[i]; });
+    }
+    auto inlined_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    BOOST_CHECK(std::all_of(c.begin(), c.end(), [](float x) { return x == 3.0f; }));
+
+    std::cout << "per-element std::function: " << erased_time / rounds << "us, inlined template: "
+              << inlined_time / rounds << "us per loop of " << size << " elements" << std::endl;
+
+    // the shared pool overloads accept any callable, too
+    std::atomic<size_t> total{ 0 };
+    dsn::parallel_for(1000, [&](size_t begin, size_t end) { total += end - begin; }, 2u);
+    dsn::parallel_for(1000, [&](size_t) { total++; }, dsn::loop_options());
+    BOOST_CHECK(total == 2000);
+}
@@ -0,0 +1,169 @@
+#define BOOST_TEST_MODULE "dsn::parallel_reduce"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dsnutil/parallel_reduce.h>
+
+#include <boost/test/unit_test.hpp>
+
+using Clock = std::chrono::high_resolution_clock;
+
+BOOST_AUTO_TEST_CASE(sum)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 100000 };
+    std::vector<long long> values(size);
+    std::iota(values.begin(), values.end(), 1);
+
+    auto plus = [](long long a, long long b) { return a + b; };
+    const long long expected = static_cast<long long>(size) * (size + 1) / 2;
+
+    // range body
+    auto total = dsn::parallel_reduce(pool, size, 0ll,
+        [&](size_t begin, size_t end, long long init) {
+            return std::accumulate(values.begin() + begin, values.begin() + end, init);
+        },
+        plus);
+    BOOST_CHECK(total == expected);
+
+    // per-index body with every schedule
+    for (auto schedule : { dsn::loop_schedule::fixed, dsn::loop_schedule::dynamic, dsn::loop_schedule::guided }) {
+        dsn::loop_options options;
+        options.schedule = schedule;
+        total = dsn::parallel_reduce(pool, size, 0ll, [&](long long acc, size_t i) { return acc + values[i]; }, plus,
+            options);
+        BOOST_CHECK(total == expected);
+    }
+
+    // shared pool and the empty range
+    BOOST_CHECK(dsn::parallel_reduce(size, 0ll, [&](long long acc, size_t i) { return acc + values[i]; }, plus)
+        == expected);
+    BOOST_CHECK(dsn::parallel_reduce(pool, 0, 42ll, [](long long acc, size_t) { return acc + 1; }, plus) == 42);
+}
+
+BOOST_AUTO_TEST_CASE(other_types)
+{
+    dsn::ThreadPool pool(3);
+    const size_t size{ 5000 };
+
+    auto maximum = dsn::parallel_reduce(pool, size, std::numeric_limits<double>::lowest(),
+        [](double acc, size_t i) { return std::max(acc, std::sin(static_cast<double>(i))); },
+        [](double a, double b) { return std::max(a, b); });
+    double expected = std::numeric_limits<double>::lowest();
+    for (size_t i = 0; i < size; ++i) {
+        expected = std::max(expected, std::sin(static_cast<double>(i)));
+    }
+    BOOST_CHECK(maximum == expected);
+
+    // histogram with a non-trivial partial type
+    auto histogram = dsn::parallel_reduce(pool, size, std::vector<size_t>(10, 0),
+        [](std::vector<size_t> acc, size_t i) {
+            acc[i % 10]++;
+            return acc;
+        },
+        [](std::vector<size_t> a, const std::vector<size_t>& b) {
+            for (size_t i = 0; i < a.size(); ++i) {
+                a[i] += b[i];
+            }
+            return a;
+        });
+    BOOST_REQUIRE(histogram.size() == 10);
+    for (auto count : histogram) {
+        BOOST_CHECK(count == size / 10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(non_commutative)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 20000 };
+    std::string expected;
+    for (size_t i = 0; i < size; ++i) {
+        expected += static_cast<char>('a' + i % 26);
+    }
+
+    // string concatenation is associative but not commutative, so chunks must be combined in order
+    for (auto schedule : { dsn::loop_schedule::fixed, dsn::loop_schedule::dynamic, dsn::loop_schedule::guided }) {
+        dsn::loop_options options;
+        options.schedule = schedule;
+        options.grain = 16;
+        auto text = dsn::parallel_reduce(pool, size, std::string(),
+            [](std::string acc, size_t i) {
+                acc += static_cast<char>('a' + i % 26);
+                return acc;
+            },
+            [](std::string a, const std::string& b) { return a + b; }, options);
+        BOOST_CHECK(text == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(nested_and_exceptions)
+{
+    dsn::ThreadPool pool(2);
+    auto plus = [](size_t a, size_t b) { return a + b; };
+
+    auto outer = pool.enqueue([&]() {
+        return dsn::parallel_reduce(pool, 1000, size_t(0), [](size_t acc, size_t) { return acc + 1; }, plus);
+    });
+    BOOST_REQUIRE(outer.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    BOOST_CHECK(outer.get() == 1000);
+
+    BOOST_CHECK_THROW(dsn::parallel_reduce(pool, 1000, size_t(0),
+                          [](size_t acc, size_t i) -> size_t {
+                              if (i == 500) {
+                                  throw std::runtime_error("failed");
+                              }
+                              return acc + 1;
+                          },
+                          plus),
+        std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(benchmark)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 1 << 20 };
+    std::vector<double> values(size);
+    for (size_t i = 0; i < size; ++i) {
+        values[i] = static_cast<double>(i % 1000);
+    }
+    const double expected = std::accumulate(values.begin(), values.end(), 0.0);
+
+    auto start = Clock::now();
+    std::mutex mutex;
+    double locked{ 0.0 };
+    dsn::parallel_for(pool, size, [&](size_t i) {
+        std::lock_guard<std::mutex> lock(mutex);
+        locked += values[i];
+    });
+    auto locked_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+    start = Clock::now();
+    std::atomic<long long> atomic{ 0 };
+    dsn::parallel_for(pool, size, [&](size_t i) { atomic += static_cast<long long>(values[i]); });
+    auto atomic_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+    start = Clock::now();
+    double reduced = dsn::parallel_reduce(pool, size, 0.0,
+        [&](size_t begin, size_t end, double init) {
+            return std::accumulate(values.begin() + begin, values.begin() + end, init);
+        },
+        [](double a, double b) { return a + b; });
+    auto reduce_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+    BOOST_CHECK(locked == expected);
+    BOOST_CHECK(static_cast<double>(atomic.load()) == expected);
+    BOOST_CHECK(reduced == expected);
+    std::cout << "sum of " << size << " doubles: mutex " << locked_time << "us, atomic " << atomic_time
+              << "us, parallel_reduce " << reduce_time << "us" << std::endl;
+}
@@ -0,0 +1,152 @@
+#define BOOST_TEST_MODULE "dsn::parallel_scan"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dsnutil/parallel_scan.h>
+
+#include <boost/test/unit_test.hpp>
+
+using Clock = std::chrono::high_resolution_clock;
+
+BOOST_AUTO_TEST_CASE(inclusive_sum)
+{
+    dsn::ThreadPool pool(4);
+    for (size_t size : { 0, 1, 1000, 1023, 4096, 100000, 1000003 }) {
+        std::vector<long long> values(size);
+        for (size_t i = 0; i < size; ++i) {
+            values[i] = static_cast<long long>(i % 17) - 8;
+        }
+        std::vector<long long> expected(size), result(size);
+        std::partial_sum(values.begin(), values.end(), expected.begin());
+
+        auto end = dsn::parallel_inclusive_scan(pool, values.begin(), values.end(), result.begin());
+        BOOST_CHECK(end == result.end());
+        BOOST_CHECK(result == expected);
+
+        // in place, on the shared pool
+        dsn::parallel_inclusive_scan(values.begin(), values.end(), values.begin());
+        BOOST_CHECK(values == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(many_blocks)
+{
+    // with more than 1024 blocks the rounded-up block size used to leave the trailing blocks empty
+    dsn::ThreadPool pool(300);
+    const size_t size{ 1100 * dsn::detail::min_scan_block + 1 };
+    std::vector<long long> values(size);
+    for (size_t i = 0; i < size; ++i) {
+        values[i] = static_cast<long long>(i % 7) - 3;
+    }
+
+    std::vector<long long> expected(size), result(size);
+    std::partial_sum(values.begin(), values.end(), expected.begin());
+    BOOST_CHECK(dsn::parallel_inclusive_scan(pool, values.begin(), values.end(), result.begin()) == result.end());
+    BOOST_CHECK(result == expected);
+
+    std::vector<long long> exclusive(size);
+    dsn::parallel_exclusive_scan(pool, values.begin(), values.end(), exclusive.begin(), 0LL);
+    BOOST_CHECK(exclusive.front() == 0);
+    BOOST_CHECK(std::equal(exclusive.begin() + 1, exclusive.end(), expected.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(exclusive_offsets)
+{
+    dsn::ThreadPool pool(3);
+
+    // histogram -> offsets -> scatter
+    const size_t num_records{ 200000 };
+    std::vector<unsigned> lengths(num_records);
+    for (size_t i = 0; i < num_records; ++i) {
+        lengths[i] = static_cast<unsigned>((i * 7919) % 13);
+    }
+    std::vector<size_t> offsets(num_records);
+    dsn::parallel_exclusive_scan(pool, lengths.begin(), lengths.end(), offsets.begin(), size_t(0));
+
+    size_t offset{ 0 };
+    for (size_t i = 0; i < num_records; ++i) {
+        BOOST_REQUIRE(offsets[i] == offset);
+        offset += lengths[i];
+    }
+
+    std::vector<size_t> records(offset);
+    dsn::parallel_for(pool, num_records, [&](size_t i) {
+        for (unsigned k = 0; k < lengths[i]; ++k) {
+            records[offsets[i] + k] = i;
+        }
+    });
+    BOOST_CHECK(std::is_sorted(records.begin(), records.end()));
+
+    // initial value and custom operation, in place
+    std::vector<long long> values(5000, 2);
+    dsn::parallel_exclusive_scan(
+        pool, values.begin(), values.end(), values.begin(), 1ll, [](long long a, long long b) { return a * b % 1000003; });
+    long long expected{ 1 };
+    for (size_t i = 0; i < values.size(); ++i) {
+        BOOST_REQUIRE(values[i] == expected);
+        expected = expected * 2 % 1000003;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(non_commutative)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 5000 };
+    std::vector<std::string> letters(size);
+    for (size_t i = 0; i < size; ++i) {
+        letters[i] = std::string(1, static_cast<char>('a' + i % 26));
+    }
+
+    std::vector<std::string> prefixes(size);
+    auto concat = [](const std::string& a, const std::string& b) { return a + b; };
+    dsn::parallel_inclusive_scan(pool, letters.begin(), letters.end(), prefixes.begin(), concat);
+    std::string expected;
+    for (size_t i = 0; i < size; ++i) {
+        expected += letters[i];
+        BOOST_REQUIRE(prefixes[i] == expected);
+    }
+
+    dsn::parallel_exclusive_scan(pool, letters.begin(), letters.end(), prefixes.begin(), std::string(">"), concat);
+    BOOST_CHECK(prefixes.front() == ">");
+    BOOST_CHECK(prefixes.back() == ">" + expected.substr(0, size - 1));
+}
+
+BOOST_AUTO_TEST_CASE(exceptions)
+{
+    dsn::ThreadPool pool(2);
+    std::vector<int> values(100000, 1);
+    BOOST_CHECK_THROW(dsn::parallel_inclusive_scan(pool, values.begin(), values.end(), values.begin(),
+                          [](int a, int b) -> int {
+                              if (a > 50000) {
+                                  throw std::overflow_error("too large");
+                              }
+                              return a + b;
+                          }),
+        std::overflow_error);
+}
+
+BOOST_AUTO_TEST_CASE(benchmark)
+{
+    dsn::ThreadPool pool(4);
+    const size_t size{ 1 << 22 };
+    std::vector<unsigned> values(size, 3);
+    std::vector<unsigned long long> serial(size), parallel(size);
+
+    auto start = Clock::now();
+    std::partial_sum(values.begin(), values.end(), serial.begin());
+    auto serial_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+    start = Clock::now();
+    dsn::parallel_inclusive_scan(pool, values.begin(), values.end(), parallel.begin());
+    auto parallel_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+    BOOST_CHECK(serial == parallel);
+    std::cout << "prefix sum of " << size << " elements: serial " << serial_time << "us, parallel " << parallel_time
+              << "us" << std::endl;
+}
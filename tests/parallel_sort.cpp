@@ -0,0 +1,140 @@
+#define BOOST_TEST_MODULE "dsn::parallel_sort"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dsnutil/parallel_sort.h>
+
+#include <boost/test/unit_test.hpp>
+
+using Clock = std::chrono::high_resolution_clock;
+
+namespace {
+std::vector<unsigned> random_values(size_t size, unsigned max, unsigned seed = 42)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<unsigned> dist(0, max);
+    std::vector<unsigned> values(size);
+    for (auto& value : values) {
+        value = dist(rng);
+    }
+    return values;
+}
+}
+
+BOOST_AUTO_TEST_CASE(sort)
+{
+    dsn::ThreadPool pool(4);
+    for (size_t size : { 0, 1, 1000, 40000, 100003, 1000000 }) {
+        auto values = random_values(size, 1000000);
+        auto expected = values;
+        std::sort(expected.begin(), expected.end());
+
+        dsn::parallel_sort(pool, values.begin(), values.end());
+        BOOST_CHECK(values == expected);
+
+        std::reverse(values.begin(), values.end());
+        dsn::parallel_sort(values.begin(), values.end(), std::greater<unsigned>());
+        BOOST_CHECK(std::is_sorted(values.begin(), values.end(), std::greater<unsigned>()));
+    }
+
+    // already sorted and all-equal input, non-contiguous iterators
+    std::vector<unsigned> sorted(300000);
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        sorted[i] = static_cast<unsigned>(i / 3);
+    }
+    auto copy = sorted;
+    dsn::parallel_sort(pool, copy.begin(), copy.end());
+    BOOST_CHECK(copy == sorted);
+
+    std::deque<unsigned> same(200000, 7);
+    dsn::parallel_sort(pool, same.begin(), same.end());
+    BOOST_CHECK(std::all_of(same.begin(), same.end(), [](unsigned x) { return x == 7; }));
+}
+
+BOOST_AUTO_TEST_CASE(stable_sort)
+{
+    dsn::ThreadPool pool(3);
+    const size_t size{ 500000 };
+    auto keys = random_values(size, 100);
+
+    std::vector<std::pair<unsigned, size_t> > records(size);
+    for (size_t i = 0; i < size; ++i) {
+        records[i] = std::make_pair(keys[i], i);
+    }
+    auto by_key = [](const std::pair<unsigned, size_t>& a, const std::pair<unsigned, size_t>& b) {
+        return a.first < b.first;
+    };
+    auto expected = records;
+    std::stable_sort(expected.begin(), expected.end(), by_key);
+
+    dsn::parallel_stable_sort(pool, records.begin(), records.end(), by_key);
+    BOOST_CHECK(records == expected);
+
+    // element type that is expensive to copy
+    std::vector<std::string> words(100000);
+    for (size_t i = 0; i < words.size(); ++i) {
+        words[i] = std::to_string((i * 7919) % 100000);
+    }
+    auto sorted_words = words;
+    std::sort(sorted_words.begin(), sorted_words.end());
+    dsn::parallel_stable_sort(words.begin(), words.end());
+    BOOST_CHECK(words == sorted_words);
+}
+
+BOOST_AUTO_TEST_CASE(nested)
+{
+    dsn::ThreadPool pool(2);
+    auto values = random_values(200000, 1000);
+    auto expected = values;
+    std::sort(expected.begin(), expected.end());
+
+    auto done = pool.enqueue([&]() { dsn::parallel_sort(pool, values.begin(), values.end()); });
+    BOOST_REQUIRE(done.wait_for(std::chrono::seconds(30)) == std::future_status::ready);
+    done.get();
+    BOOST_CHECK(values == expected);
+}
+
+/// Compares against std::sort for 1M elements and, if DSNUTIL_SORT_BENCHMARK_MAX is set, for every
+/// tenfold size up to it (e.g. DSNUTIL_SORT_BENCHMARK_MAX=1000000000 for 1B elements).
+BOOST_AUTO_TEST_CASE(benchmark)
+{
+    size_t max_size{ 1000000 };
+    if (const char* env = std::getenv("DSNUTIL_SORT_BENCHMARK_MAX")) {
+        max_size = std::max<size_t>(std::strtoull(env, nullptr, 10), max_size);
+    }
+
+    dsn::ThreadPool& pool = dsn::parallel_pool();
+    for (size_t size = 1000000; size <= max_size; size *= 10) {
+        const auto input = random_values(size, 0xffffffffu, static_cast<unsigned>(size));
+
+        auto values = input;
+        auto start = Clock::now();
+        std::sort(values.begin(), values.end());
+        auto serial_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+
+        auto parallel = input;
+        start = Clock::now();
+        dsn::parallel_sort(pool, parallel.begin(), parallel.end());
+        auto parallel_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+        BOOST_CHECK(parallel == values);
+
+        parallel = input;
+        start = Clock::now();
+        dsn::parallel_stable_sort(pool, parallel.begin(), parallel.end());
+        auto stable_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+        BOOST_CHECK(parallel == values);
+
+        std::cout << "sorting " << size << " elements on " << pool.num_workers() << " workers: std::sort "
+                  << serial_time << "ms, parallel_sort " << parallel_time << "ms, parallel_stable_sort "
+                  << stable_time << "ms" << std::endl;
+    }
+}
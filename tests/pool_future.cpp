@@ -0,0 +1,177 @@
+#define BOOST_TEST_MODULE "dsn::pool_future"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dsnutil/pool_future.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE(async_result)
+{
+    dsn::ThreadPool pool(2);
+
+    auto answer = dsn::async(pool, [](int a, int b) { return a * b; }, 6, 7);
+    BOOST_CHECK(answer.valid());
+    BOOST_CHECK(answer.get() == 42);
+    BOOST_CHECK(!answer.valid());
+
+    auto moved = dsn::async(pool, [](std::unique_ptr<int> value) { return value; },
+        std::unique_ptr<int>(new int(3)));
+    BOOST_CHECK(*moved.get() == 3);
+
+    std::atomic<bool> ran{ false };
+    auto nothing = dsn::async(pool, [&ran]() { ran = true; });
+    nothing.get();
+    BOOST_CHECK(ran);
+
+    auto failed = dsn::async(pool, []() -> int { throw std::runtime_error("failed"); });
+    BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(then_chain)
+{
+    dsn::ThreadPool pool(2);
+
+    auto result = dsn::async(pool, []() { return 2; })
+                      .then([](dsn::pool_future<int> f) { return f.get() * 10; })
+                      .then([](dsn::pool_future<int> f) { return std::to_string(f.get() + 1); });
+    BOOST_CHECK(result.get() == "21");
+
+    // exceptions propagate through the chain until a continuation handles them
+    auto recovered = dsn::async(pool, []() -> int { throw std::runtime_error("failed"); })
+                         .then([](dsn::pool_future<int> f) { return f.get() + 1; })
+                         .then([](dsn::pool_future<int> f) {
+                             try {
+                                 return f.get();
+                             } catch (const std::runtime_error&) {
+                                 return -1;
+                             }
+                         });
+    BOOST_CHECK(recovered.get() == -1);
+
+    // continuations attached to ready futures are queued right away
+    auto ready = dsn::async(pool, []() { return 1; });
+    ready.wait();
+    BOOST_CHECK(ready.is_ready());
+    BOOST_CHECK(ready.then([](dsn::pool_future<int> f) { f.get(); }).wait_for(std::chrono::seconds(10))
+        == std::future_status::ready);
+}
+
+BOOST_AUTO_TEST_CASE(continuations_run_on_pool)
+{
+    dsn::ThreadPool pool(2);
+    dsn::pool_promise<int> promise(pool);
+    auto future = promise.get_future();
+    BOOST_CHECK_THROW(promise.get_future(), std::future_error);
+
+    auto on_pool = future.then([&pool](dsn::pool_future<int> f) {
+        f.get();
+        return pool.is_worker_thread();
+    });
+    BOOST_CHECK(on_pool.wait_for(std::chrono::milliseconds(10)) == std::future_status::timeout);
+
+    promise.set_value(1);
+    BOOST_CHECK_THROW(promise.set_value(2), std::future_error);
+    BOOST_CHECK(on_pool.get());
+
+    // without a pool continuations run on the thread that satisfies the promise
+    dsn::pool_promise<void> inline_promise;
+    const auto self = std::this_thread::get_id();
+    auto same_thread = inline_promise.get_future().then([self](dsn::pool_future<void>) {
+        return std::this_thread::get_id() == self;
+    });
+    inline_promise.set_value();
+    BOOST_CHECK(same_thread.is_ready());
+    BOOST_CHECK(same_thread.get());
+}
+
+BOOST_AUTO_TEST_CASE(broken_promise)
+{
+    dsn::pool_future<int> future;
+    {
+        dsn::pool_promise<int> promise;
+        future = promise.get_future();
+    }
+    BOOST_CHECK_THROW(future.get(), std::future_error);
+}
+
+BOOST_AUTO_TEST_CASE(evicted_task_continuation)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.queue_capacity = 2;
+    options.overflow = dsn::overflow_policy::drop_oldest;
+    dsn::ThreadPool pool(options);
+
+    std::promise<void> gate;
+    std::shared_future<void> open = gate.get_future().share();
+    pool.post([open]() { open.wait(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // evicting the first task breaks its promise, which queues the continuation on the same pool
+    auto dropped = dsn::async(pool, []() { return 1; }).then([](dsn::pool_future<int> f) {
+        try {
+            return f.get();
+        } catch (const std::future_error&) {
+            return -1;
+        }
+    });
+    pool.post([]() {});
+    pool.post([]() {});
+
+    gate.set_value();
+    BOOST_REQUIRE(dropped.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    BOOST_CHECK(dropped.get() == -1);
+}
+
+BOOST_AUTO_TEST_CASE(when_all_futures)
+{
+    dsn::ThreadPool pool(4);
+
+    std::vector<dsn::pool_future<size_t> > futures;
+    for (size_t i = 0; i < 100; ++i) {
+        futures.push_back(dsn::async(pool, [i]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(100 * (i % 7)));
+            return i;
+        }));
+    }
+
+    auto sum = dsn::when_all(futures.begin(), futures.end())
+                   .then([](dsn::pool_future<std::vector<dsn::pool_future<size_t> > > all) {
+                       size_t total{ 0 };
+                       for (auto& f : all.get()) {
+                           total += f.get();
+                       }
+                       return total;
+                   });
+    BOOST_CHECK(sum.get() == 99 * 100 / 2);
+
+    std::vector<dsn::pool_future<int> > none;
+    BOOST_CHECK(dsn::when_all(none.begin(), none.end()).get().empty());
+}
+
+BOOST_AUTO_TEST_CASE(when_any_future)
+{
+    dsn::ThreadPool pool(2);
+
+    dsn::pool_promise<int> never(pool);
+    std::vector<dsn::pool_future<int> > futures;
+    futures.push_back(never.get_future());
+    futures.push_back(dsn::async(pool, []() { return 5; }));
+
+    auto any = dsn::when_any(futures.begin(), futures.end()).get();
+    BOOST_CHECK(any.index == 1);
+    BOOST_CHECK(any.futures.size() == 2);
+    BOOST_CHECK(any.futures[1].get() == 5);
+    BOOST_CHECK(!any.futures[0].is_ready());
+
+    never.set_value(0);
+    BOOST_CHECK(any.futures[0].get() == 0);
+}
@@ -0,0 +1,183 @@
+#define BOOST_TEST_MODULE "dsn::strand"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <dsnutil/strand.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE(fifo_order)
+{
+    dsn::ThreadPool pool(4);
+    dsn::strand s(pool);
+
+    const size_t num_tasks{ 10000 };
+    std::vector<size_t> order;
+    for (size_t i = 0; i < num_tasks; ++i) {
+        s.post([&order, i]() { order.push_back(i); });
+    }
+    s.enqueue([]() {}).get();
+
+    BOOST_REQUIRE(order.size() == num_tasks);
+    for (size_t i = 0; i < num_tasks; ++i) {
+        BOOST_CHECK(order[i] == i);
+    }
+    BOOST_CHECK(s.pending() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(never_concurrent)
+{
+    dsn::ThreadPool pool(4);
+    dsn::strand s(pool);
+
+    const size_t num_producers{ 4 };
+    const size_t tasks_per_producer{ 2000 };
+    std::atomic<int> running{ 0 };
+    std::atomic<bool> overlap{ false };
+    std::vector<std::vector<size_t> > seen(num_producers);
+
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < num_producers; ++p) {
+        producers.emplace_back([&, p]() {
+            for (size_t i = 0; i < tasks_per_producer; ++i) {
+                s.post([&, p, i]() {
+                    if (running++ != 0) {
+                        overlap = true;
+                    }
+                    // unsynchronized on purpose: the strand guarantees exclusive access
+                    seen[p].push_back(i);
+                    running--;
+                });
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    s.enqueue([]() {}).get();
+
+    BOOST_CHECK(!overlap);
+    for (size_t p = 0; p < num_producers; ++p) {
+        BOOST_REQUIRE(seen[p].size() == tasks_per_producer);
+        for (size_t i = 0; i < tasks_per_producer; ++i) {
+            BOOST_CHECK(seen[p][i] == i);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(many_strands)
+{
+    dsn::ThreadPool pool(4);
+
+    const size_t num_strands{ 5000 };
+    const size_t tasks_per_strand{ 10 };
+    std::vector<dsn::strand> strands;
+    std::unique_ptr<size_t[]> counters(new size_t[num_strands]());
+    for (size_t i = 0; i < num_strands; ++i) {
+        strands.emplace_back(pool);
+    }
+
+    for (size_t t = 0; t < tasks_per_strand; ++t) {
+        for (size_t i = 0; i < num_strands; ++i) {
+            size_t* counter = &counters[i];
+            strands[i].post([counter, t]() {
+                if (*counter == t) {
+                    ++*counter;
+                }
+            });
+        }
+    }
+
+    std::vector<std::future<void> > done;
+    for (auto& s : strands) {
+        done.push_back(s.enqueue([]() {}));
+    }
+    for (auto& f : done) {
+        f.get();
+    }
+
+    for (size_t i = 0; i < num_strands; ++i) {
+        BOOST_CHECK(counters[i] == tasks_per_strand);
+    }
+    BOOST_CHECK(sizeof(dsn::strand) <= 2 * sizeof(void*));
+}
+
+BOOST_AUTO_TEST_CASE(results_and_move_only_arguments)
+{
+    dsn::ThreadPool pool(2);
+    dsn::strand s(pool);
+
+    auto result = s.enqueue([](std::unique_ptr<int> value) { return *value * 2; }, std::unique_ptr<int>(new int(21)));
+    BOOST_CHECK(result.get() == 42);
+
+    // the strand keeps working after the pool stopped, on the submitting thread
+    pool.stop();
+    BOOST_CHECK(s.enqueue([]() { return std::this_thread::get_id(); }).get() == std::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(discarded_drain)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.queue_capacity = 1;
+    options.overflow = dsn::overflow_policy::drop_oldest;
+    dsn::ThreadPool pool(options);
+
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    std::promise<void> started;
+    pool.post([open, &started]() {
+        started.set_value();
+        open.wait();
+    });
+    started.get_future().wait();
+
+    // evicting the drain task discards the queued tasks instead of leaving the strand busy forever
+    dsn::strand s(pool);
+    auto dropped = s.enqueue([]() { return 1; });
+    pool.post([]() {});
+    BOOST_CHECK(s.pending() == 0);
+    BOOST_CHECK_THROW(dropped.get(), std::future_error);
+
+    gate.set_value();
+    BOOST_CHECK(s.enqueue([]() { return 2; }).get() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(shutdown_now_discards_drain)
+{
+    dsn::ThreadPool pool(1);
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    std::promise<void> started;
+    pool.post([open, &started]() {
+        started.set_value();
+        open.wait();
+    });
+    started.get_future().wait();
+
+    dsn::strand s(pool);
+    auto dropped = s.enqueue([]() { return 1; });
+    std::thread release([&gate]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        gate.set_value();
+    });
+    BOOST_CHECK(pool.shutdown_now().size() == 1);
+    release.join();
+
+    BOOST_CHECK(s.pending() == 0);
+    BOOST_CHECK_THROW(dropped.get(), std::future_error);
+    BOOST_CHECK(s.enqueue([]() { return 2; }).get() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(cancellation_token_rejected)
+{
+    dsn::ThreadPool pool(1);
+    dsn::cancellation_source source;
+    dsn::task_options options;
+    options.token = source.token();
+    BOOST_CHECK_THROW(dsn::strand(pool, options), dsn::Exception);
+}
@@ -0,0 +1,106 @@
+#define BOOST_TEST_MODULE "dsn::task"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include <dsnutil/task.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+std::atomic<size_t> allocations{ 0 };
+}
+
+// all replaceable forms are replaced so that every allocation is paired with a matching malloc()/free()
+void* operator new(size_t size)
+{
+    allocations++;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+#endif
+
+using dsn::task;
+
+BOOST_AUTO_TEST_CASE(default_construction)
+{
+    task t;
+    BOOST_CHECK(!t);
+    BOOST_CHECK(t.is_inline() == false);
+
+    task n(nullptr);
+    BOOST_CHECK(!n);
+}
+
+BOOST_AUTO_TEST_CASE(small_callable_is_inline)
+{
+    int value{ 0 };
+    size_t before = allocations;
+    task t([&value]() { value = 42; });
+    t();
+    BOOST_CHECK(allocations == before);
+    BOOST_CHECK(t.is_inline());
+    BOOST_CHECK(value == 42);
+}
+
+BOOST_AUTO_TEST_CASE(large_callable_on_heap)
+{
+    std::array<char, task::inline_size + 1> payload;
+    payload.fill('x');
+    char result{ 0 };
+
+    task t([payload, &result]() { result = payload[0]; });
+    BOOST_CHECK(t.is_inline() == false);
+    t();
+    BOOST_CHECK(result == 'x');
+}
+
+BOOST_AUTO_TEST_CASE(move_only_callable)
+{
+    std::unique_ptr<int> ptr(new int(23));
+    int result{ 0 };
+    auto f = [&result](std::unique_ptr<int> p) { result = *p; };
+
+    task t(dsn::detail::bind_call(f, std::move(ptr)));
+    BOOST_CHECK(ptr == nullptr);
+    t();
+    BOOST_CHECK(result == 23);
+}
+
+BOOST_AUTO_TEST_CASE(move_semantics)
+{
+    std::shared_ptr<int> counter = std::make_shared<int>(0);
+    task a([counter]() { ++*counter; });
+    BOOST_CHECK(counter.use_count() == 2);
+
+    task b(std::move(a));
+    BOOST_CHECK(!a);
+    BOOST_CHECK(static_cast<bool>(b));
+    b();
+    BOOST_CHECK(*counter == 1);
+
+    task c;
+    c = std::move(b);
+    BOOST_CHECK(!b);
+    c();
+    BOOST_CHECK(*counter == 2);
+
+    c = nullptr;
+    BOOST_CHECK(counter.use_count() == 1);
+}
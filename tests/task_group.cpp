@@ -0,0 +1,168 @@
+#define BOOST_TEST_MODULE "dsn::task_group"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <dsnutil/task_group.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE(wait_for_all_tasks)
+{
+    dsn::ThreadPool pool(4);
+    dsn::task_group group(pool);
+
+    const size_t num_tasks{ 1000 };
+    std::atomic<size_t> completed{ 0 };
+    for (size_t i = 0; i < num_tasks; ++i) {
+        group.run([&completed](size_t increment) { completed += increment; }, 1);
+    }
+    group.wait();
+    BOOST_CHECK(completed == num_tasks);
+    BOOST_CHECK(group.pending() == 0);
+
+    // groups can be reused after waiting
+    group.run([&completed](std::unique_ptr<size_t> increment) { completed += *increment; },
+        std::unique_ptr<size_t>(new size_t(1)));
+    group.wait();
+    BOOST_CHECK(completed == num_tasks + 1);
+}
+
+BOOST_AUTO_TEST_CASE(wait_for_timeout)
+{
+    dsn::ThreadPool pool(1);
+    dsn::task_group group(pool);
+
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    group.run([open]() { open.wait(); });
+
+    BOOST_CHECK(!group.wait_for(std::chrono::milliseconds(20)));
+    BOOST_CHECK(group.pending() == 1);
+    gate.set_value();
+    BOOST_CHECK(group.wait_for(std::chrono::seconds(10)));
+}
+
+BOOST_AUTO_TEST_CASE(exceptions)
+{
+    dsn::ThreadPool pool(2);
+    dsn::task_group group(pool);
+
+    std::atomic<size_t> completed{ 0 };
+    for (size_t i = 0; i < 10; ++i) {
+        group.run([&completed, i]() {
+            if (i == 3) {
+                throw std::runtime_error("failed");
+            }
+            completed++;
+        });
+    }
+    BOOST_CHECK_THROW(group.wait(), std::runtime_error);
+    BOOST_CHECK(completed == 9);
+
+    // the exception is only reported once
+    group.wait();
+}
+
+/// \brief Recursive fork/join on a single worker would deadlock if waiting blocked the worker
+size_t fibonacci(dsn::ThreadPool& pool, size_t n)
+{
+    if (n < 2) {
+        return n;
+    }
+
+    size_t a{ 0 }, b{ 0 };
+    dsn::task_group group(pool);
+    group.run([&pool, &a, n]() { a = fibonacci(pool, n - 1); });
+    group.run([&pool, &b, n]() { b = fibonacci(pool, n - 2); });
+    group.wait();
+    return a + b;
+}
+
+BOOST_AUTO_TEST_CASE(nested_fork_join)
+{
+    for (bool stealing : { false, true }) {
+        dsn::thread_pool_options options;
+        options.num_threads = 1;
+        options.work_stealing = stealing;
+        dsn::ThreadPool pool(options);
+
+        BOOST_CHECK(pool.enqueue([&pool]() { return fibonacci(pool, 15); }).get() == 610);
+    }
+
+    dsn::ThreadPool pool(4);
+    BOOST_CHECK(pool.enqueue([&pool]() { return fibonacci(pool, 18); }).get() == 2584);
+}
+
+BOOST_AUTO_TEST_CASE(dropped_tasks)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.queue_capacity = 1;
+    options.overflow = dsn::overflow_policy::drop_oldest;
+    dsn::ThreadPool pool(options);
+
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    std::promise<void> started;
+    pool.post([open, &started]() {
+        started.set_value();
+        open.wait();
+    });
+    started.get_future().wait();
+
+    dsn::task_group group(pool);
+    std::atomic<size_t> completed{ 0 };
+    for (size_t i = 0; i < 5; ++i) {
+        group.run([&completed]() { completed++; });
+    }
+    gate.set_value();
+
+    // tasks discarded by the overflow policy must not keep the group waiting
+    BOOST_CHECK(group.wait_for(std::chrono::seconds(10)));
+    BOOST_CHECK(completed == 1);
+}
+
+BOOST_AUTO_TEST_CASE(rejected_tasks)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.queue_capacity = 1;
+    options.overflow = dsn::overflow_policy::reject;
+    dsn::ThreadPool pool(options);
+
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    std::promise<void> started;
+    pool.post([open, &started]() {
+        started.set_value();
+        open.wait();
+    });
+    started.get_future().wait();
+
+    dsn::task_group group(pool);
+    std::atomic<size_t> completed{ 0 };
+    group.run([&completed]() { completed++; });
+    BOOST_CHECK_THROW(group.run([&completed]() { completed++; }), dsn::Exception);
+    BOOST_CHECK(group.pending() == 1);
+    gate.set_value();
+
+    BOOST_CHECK(group.wait_for(std::chrono::seconds(10)));
+    BOOST_CHECK(group.pending() == 0);
+    BOOST_CHECK(completed == 1);
+}
+
+BOOST_AUTO_TEST_CASE(stopped_pool)
+{
+    dsn::ThreadPool pool(1);
+    dsn::task_group group(pool);
+    pool.stop();
+
+    BOOST_CHECK_THROW(group.run([]() {}), dsn::Exception);
+    BOOST_CHECK(group.pending() == 0);
+    BOOST_CHECK(group.wait_for(std::chrono::seconds(10)));
+}
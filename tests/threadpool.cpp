@@ -1,7 +1,9 @@
 #define BOOST_TEST_MODULE "dsn::ThreadPool"
 
+#include <algorithm>
 #include <chrono>
 #include <dsnutil/threadpool.h>
+#include <functional>
 #include <iostream>
 #include <mutex>
 
@@ -122,3 +124,1102 @@ BOOST_AUTO_TEST_CASE(enqueue_with_future)
         }
     }
 }
+
+BOOST_AUTO_TEST_CASE(work_stealing_construction)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 4;
+    options.work_stealing = true;
+
+    ThreadPool pool(options);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    BOOST_CHECK(pool.num_workers() == 4);
+    BOOST_CHECK(pool.work_stealing() == true);
+    BOOST_CHECK(pool.idle() == true);
+}
+
+BOOST_AUTO_TEST_CASE(work_stealing_nested_enqueue)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 4;
+    options.work_stealing = true;
+    ThreadPool pool(options);
+
+    // every outer task fans out into inner tasks from within the worker, which end up on the
+    // worker's local deque and have to be stolen by the others to keep all workers busy
+    const size_t num_outer{ 64 };
+    const size_t num_inner{ 64 };
+    std::atomic<size_t> completed{ 0 };
+    for (size_t i = 0; i < num_outer; ++i) {
+        pool.enqueue([&]() {
+            for (size_t j = 0; j < num_inner; ++j) {
+                pool.enqueue([&]() { completed++; });
+            }
+        });
+    }
+
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+
+    BOOST_CHECK(completed == num_outer * num_inner);
+}
+
+BOOST_AUTO_TEST_CASE(stop_twice)
+{
+    ThreadPool pool(2);
+    auto result = pool.enqueue([]() { return 42; });
+    pool.stop();
+    BOOST_CHECK(result.get() == 42);
+    pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(post_fire_and_forget)
+{
+    ThreadPool pool(2);
+    std::atomic<size_t> completed{ 0 };
+    const size_t num_tasks{ 1000 };
+    for (size_t i = 0; i < num_tasks; ++i) {
+        pool.post([&completed]() { completed++; });
+    }
+
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+    BOOST_CHECK(completed == num_tasks);
+}
+
+BOOST_AUTO_TEST_CASE(move_only_arguments)
+{
+    ThreadPool pool(2);
+    std::unique_ptr<int> ptr(new int(21));
+    auto result = pool.enqueue([](std::unique_ptr<int> p) { return *p * 2; }, std::move(ptr));
+    BOOST_CHECK(result.get() == 42);
+
+    std::promise<int> promise;
+    auto future = promise.get_future();
+    std::unique_ptr<int> other(new int(7));
+    pool.post([](std::promise<int> p, std::unique_ptr<int> v) { p.set_value(*v); }, std::move(promise),
+        std::move(other));
+    BOOST_CHECK(future.get() == 7);
+}
+
+BOOST_AUTO_TEST_CASE(enqueue_bulk)
+{
+    ThreadPool pool(4);
+    std::vector<std::function<int()> > jobs;
+    for (int i = 0; i < 100; ++i) {
+        jobs.push_back([i]() { return i * i; });
+    }
+
+    auto results = pool.enqueue_bulk(jobs.begin(), jobs.end());
+    BOOST_CHECK(results.size() == jobs.size());
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK(results[i].get() == i * i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(post_bulk_benchmark)
+{
+    using Clock = std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    const size_t num_tasks{ 200000 };
+    std::atomic<size_t> completed{ 0 };
+    auto job = [&completed]() { completed++; };
+    std::vector<decltype(job)> jobs(num_tasks, job);
+
+    ThreadPool pool(4);
+
+    auto single_start = Clock::now();
+    for (auto& j : jobs) {
+        pool.post(j);
+    }
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+    auto single_time = duration_cast<microseconds>(Clock::now() - single_start).count();
+    BOOST_CHECK(completed == num_tasks);
+
+    completed = 0;
+    auto bulk_start = Clock::now();
+    pool.post_bulk(jobs.begin(), jobs.end());
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+    auto bulk_time = duration_cast<microseconds>(Clock::now() - bulk_start).count();
+    BOOST_CHECK(completed == num_tasks);
+
+    std::cout << num_tasks << " tasks via post(): " << single_time << "us, via post_bulk(): " << bulk_time << "us"
+              << std::endl;
+}
+
+namespace {
+/// \brief Occupy the (single) worker of \a pool until the returned promise is fulfilled
+std::shared_ptr<std::promise<void> > block_worker(ThreadPool& pool)
+{
+    auto gate = std::make_shared<std::promise<void> >();
+    std::shared_future<void> released(gate->get_future());
+    std::promise<void> started;
+    auto running = started.get_future();
+    pool.post([released](std::promise<void> s) {
+        s.set_value();
+        released.wait();
+    }, std::move(started));
+    running.wait();
+    return gate;
+}
+}
+
+BOOST_AUTO_TEST_CASE(strict_priority)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.priority_levels = 2;
+    ThreadPool pool(options);
+    BOOST_CHECK(pool.priority_levels() == 2);
+
+    auto gate = block_worker(pool);
+
+    Mutex mtx;
+    std::vector<unsigned> order;
+    for (unsigned i = 0; i < 4; ++i) {
+        pool.post(dsn::task_options(1), [&]() {
+            ScopedGuard g(mtx);
+            order.push_back(1);
+        });
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        pool.post(dsn::task_options(0), [&]() {
+            ScopedGuard g(mtx);
+            order.push_back(0);
+        });
+    }
+    BOOST_CHECK(pool.queue_depth(0) == 4);
+    BOOST_CHECK(pool.queue_depth(1) == 4);
+    BOOST_CHECK(pool.queue_depth(5) == 0);
+
+    gate->set_value();
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+
+    std::vector<unsigned> expected{ 0, 0, 0, 0, 1, 1, 1, 1 };
+    BOOST_CHECK(order == expected);
+    BOOST_CHECK(pool.queue_depth(0) == 0);
+    BOOST_CHECK(pool.queue_depth(1) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(weighted_fair_priority)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.priority_levels = 2;
+    options.priority_mode = dsn::priority_policy::weighted_fair;
+    options.priority_weights = { 3, 1 };
+    ThreadPool pool(options);
+
+    auto gate = block_worker(pool);
+
+    Mutex mtx;
+    std::vector<unsigned> order;
+    dsn::task_options low(1);
+    for (unsigned i = 0; i < 4; ++i) {
+        pool.post(low, [&]() {
+            ScopedGuard g(mtx);
+            order.push_back(1);
+        });
+    }
+    for (unsigned i = 0; i < 8; ++i) {
+        pool.post(dsn::task_options(0), [&]() {
+            ScopedGuard g(mtx);
+            order.push_back(0);
+        });
+    }
+
+    gate->set_value();
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+
+    // low priority tasks get one slot per round of three high priority ones (no starvation either way)
+    BOOST_REQUIRE(order.size() == 12);
+    size_t high_since_low{ 0 };
+    for (size_t i = 0; i < 8; ++i) {
+        if (order[i] == 0) {
+            BOOST_CHECK(++high_since_low <= 3);
+        } else {
+            high_since_low = 0;
+        }
+    }
+    BOOST_CHECK(order.front() == 0);
+    BOOST_CHECK(std::count(order.begin(), order.begin() + 8, 1u) >= 2);
+}
+
+namespace {
+dsn::thread_pool_options bounded_options(dsn::overflow_policy policy)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.queue_capacity = 2;
+    options.overflow = policy;
+    return options;
+}
+}
+
+BOOST_AUTO_TEST_CASE(bounded_reject)
+{
+    ThreadPool pool(bounded_options(dsn::overflow_policy::reject));
+    BOOST_CHECK(pool.queue_capacity() == 2);
+    auto gate = block_worker(pool);
+
+    auto a = pool.enqueue([]() { return 1; });
+    BOOST_CHECK(pool.try_post([]() {}) == true);
+    BOOST_CHECK_THROW(pool.enqueue([]() { return 3; }), dsn::Exception);
+    BOOST_CHECK(pool.try_post([]() {}) == false);
+    BOOST_CHECK(pool.try_enqueue([]() { return 4; }).valid() == false);
+
+    gate->set_value();
+    BOOST_CHECK(a.get() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(bounded_caller_runs)
+{
+    ThreadPool pool(bounded_options(dsn::overflow_policy::caller_runs));
+    auto gate = block_worker(pool);
+
+    pool.post([]() {});
+    pool.post([]() {});
+    auto caller = pool.enqueue([]() { return std::this_thread::get_id(); });
+    BOOST_CHECK(caller.get() == std::this_thread::get_id());
+
+    gate->set_value();
+}
+
+BOOST_AUTO_TEST_CASE(bounded_drop_oldest)
+{
+    ThreadPool pool(bounded_options(dsn::overflow_policy::drop_oldest));
+    auto gate = block_worker(pool);
+
+    auto a = pool.enqueue([]() { return 1; });
+    auto b = pool.enqueue([]() { return 2; });
+    auto c = pool.enqueue([]() { return 3; });
+    BOOST_CHECK(pool.queue_depth(0) == 2);
+
+    gate->set_value();
+    BOOST_CHECK_THROW(a.get(), std::future_error);
+    BOOST_CHECK(b.get() == 2);
+    BOOST_CHECK(c.get() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(bounded_block)
+{
+    ThreadPool pool(bounded_options(dsn::overflow_policy::block));
+    auto gate = block_worker(pool);
+
+    pool.post([]() {});
+    pool.post([]() {});
+
+    std::atomic<bool> submitted{ false };
+    std::thread producer([&]() {
+        pool.post([]() {});
+        submitted = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    BOOST_CHECK(submitted == false);
+
+    gate->set_value();
+    producer.join();
+    BOOST_CHECK(submitted == true);
+}
+
+BOOST_AUTO_TEST_CASE(elastic_sizing)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.max_threads = 4;
+    options.grow_threshold = std::chrono::milliseconds(1);
+    options.keep_alive = std::chrono::milliseconds(50);
+    ThreadPool pool(options);
+    BOOST_CHECK(pool.min_workers() == 1);
+    BOOST_CHECK(pool.max_workers() == 4);
+    BOOST_CHECK(pool.num_workers() == 1);
+
+    // keep the only worker busy so that queued tasks start to wait
+    auto gate = block_worker(pool);
+    std::promise<void> release_queued;
+    std::shared_future<void> released(release_queued.get_future());
+    for (size_t i = 0; i < 8; ++i) {
+        pool.post([released]() { released.wait(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    BOOST_CHECK(pool.num_workers() == 4);
+
+    gate->set_value();
+    release_queued.set_value();
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+
+    // surplus workers retire after keep_alive
+    for (size_t i = 0; i < 100 && pool.num_workers() > 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_CHECK(pool.num_workers() == 1);
+    BOOST_CHECK(pool.idle() == true);
+
+    // and the pool keeps working after shrinking
+    BOOST_CHECK(pool.enqueue([]() { return 5; }).get() == 5);
+}
+
+BOOST_AUTO_TEST_CASE(elastic_burst)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.max_threads = 4;
+    options.grow_threshold = std::chrono::milliseconds(1);
+    ThreadPool pool(options);
+
+    // a single burst has to grow the pool while it is worked off, without any further submissions
+    std::vector<std::function<void()> > burst;
+    for (size_t i = 0; i < 1000; ++i) {
+        burst.emplace_back([]() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+    }
+    pool.post_bulk(burst.begin(), burst.end());
+
+    size_t peak{ 0 };
+    while (!pool.idle()) {
+        peak = std::max(peak, pool.num_workers());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_CHECK(peak > 1);
+}
+
+BOOST_AUTO_TEST_CASE(elastic_stuck_workers)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.max_threads = 4;
+    options.grow_threshold = std::chrono::milliseconds(1);
+    ThreadPool pool(options);
+
+    // every worker gets stuck in a long task and nobody submits anything after the batch
+    std::promise<void> release;
+    std::shared_future<void> released(release.get_future());
+    std::vector<std::function<void()> > stuck(8, [released]() { released.wait(); });
+    pool.post_bulk(stuck.begin(), stuck.end());
+
+    for (size_t i = 0; i < 500 && pool.num_workers() < 4; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_CHECK(pool.num_workers() == 4);
+
+    release.set_value();
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(numa_topology)
+{
+    auto nodes = dsn::numa_topology();
+    BOOST_REQUIRE(!nodes.empty());
+    size_t cpus{ 0 };
+    for (auto& node : nodes) {
+        BOOST_CHECK(!node.empty());
+        cpus += node.size();
+    }
+    std::cout << "NUMA topology: " << nodes.size() << " node(s) with " << cpus << " CPUs" << std::endl;
+}
+
+BOOST_AUTO_TEST_CASE(numa_aware_placement)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 4;
+    options.numa_aware = true;
+    options.work_stealing = true;
+    ThreadPool pool(options);
+    BOOST_CHECK(pool.num_nodes() == dsn::numa_topology().size());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    size_t workers{ 0 };
+    size_t idle{ 0 };
+    for (size_t node = 0; node < pool.num_nodes(); ++node) {
+        workers += pool.num_workers(node);
+        idle += pool.idle_count(node);
+    }
+    BOOST_CHECK(workers == pool.num_workers());
+    BOOST_CHECK(idle == pool.idle_count());
+    BOOST_CHECK(pool.num_workers(pool.num_nodes()) == 0);
+
+    std::vector<std::future<int> > results;
+    for (int i = 0; i < 32; ++i) {
+        dsn::task_options hint;
+        hint.node = i;
+        results.push_back(pool.enqueue(hint, [i]() { return i; }));
+    }
+    for (int i = 0; i < 32; ++i) {
+        BOOST_CHECK(results[i].get() == i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cpu_affinity)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 2;
+    options.cpu_affinity = { 0 };
+    ThreadPool pool(options);
+    BOOST_CHECK(pool.num_nodes() == 1);
+    BOOST_CHECK(pool.enqueue([]() { return 1; }).get() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(wait_strategies)
+{
+    for (auto strategy : { dsn::wait_strategy::block, dsn::wait_strategy::spin, dsn::wait_strategy::spin_yield,
+             dsn::wait_strategy::busy_poll }) {
+        dsn::thread_pool_options options;
+        options.num_threads = 2;
+        options.idle_strategy = strategy;
+        options.spin_count = 1000;
+        ThreadPool pool(options);
+
+        const size_t num_tasks{ 1000 };
+        std::atomic<size_t> completed{ 0 };
+        for (size_t i = 0; i < num_tasks; ++i) {
+            pool.post([&completed]() { completed++; });
+            if (i % 100 == 0) {
+                // give the workers a chance to run dry and go back to waiting
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+
+        while (!pool.idle()) {
+            std::this_thread::yield();
+        }
+        BOOST_CHECK(completed == num_tasks);
+        BOOST_CHECK(pool.enqueue([]() { return 3; }).get() == 3);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(schedule_after)
+{
+    using namespace dsn;
+    ThreadPool pool(2);
+
+    const auto delay = std::chrono::milliseconds(50);
+    const auto start = dsn::chrono::clock_type::now();
+    std::promise<dsn::chrono::clock_type::time_point> fired;
+    auto result = fired.get_future();
+    pool.schedule_after(delay, [&fired]() { fired.set_value(dsn::chrono::clock_type::now()); });
+    BOOST_CHECK(result.get() - start >= delay);
+    BOOST_CHECK(pool.pending_timers() == 0);
+
+    std::promise<int> at;
+    auto at_result = at.get_future();
+    pool.schedule_at(dsn::chrono::clock_type::now() + std::chrono::milliseconds(10),
+        [&at](std::unique_ptr<int> value) { at.set_value(*value); }, std::unique_ptr<int>(new int(42)));
+    BOOST_CHECK(at_result.get() == 42);
+}
+
+BOOST_AUTO_TEST_CASE(schedule_every)
+{
+    using namespace dsn;
+    ThreadPool pool(2);
+
+    std::atomic<int> runs{ 0 };
+    auto id = pool.schedule_every(std::chrono::milliseconds(5), [&runs]() { runs++; });
+    BOOST_CHECK(pool.pending_timers() == 1);
+    while (runs < 5) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_CHECK(pool.cancel_timer(id));
+    BOOST_CHECK(!pool.cancel_timer(id));
+    BOOST_CHECK(pool.pending_timers() == 0);
+
+    // allow an already queued run to finish, then make sure no further runs happen
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const int after_cancel = runs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    BOOST_CHECK(runs == after_cancel);
+
+    BOOST_CHECK_THROW(pool.schedule_every(std::chrono::milliseconds(0), []() {}), dsn::Exception);
+}
+
+BOOST_AUTO_TEST_CASE(cancel_timer)
+{
+    using namespace dsn;
+    ThreadPool pool(2);
+
+    std::atomic<bool> fired{ false };
+    auto id = pool.schedule_after(std::chrono::milliseconds(30), [&fired]() { fired = true; });
+    BOOST_CHECK(pool.cancel_timer(id));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    BOOST_CHECK(!fired);
+
+    // timers still pending on stop() are discarded
+    pool.schedule_after(std::chrono::seconds(60), [&fired]() { fired = true; });
+    BOOST_CHECK(pool.pending_timers() == 1);
+    pool.stop();
+    BOOST_CHECK(!fired);
+    BOOST_CHECK_THROW(pool.schedule_after(std::chrono::milliseconds(1), []() {}), dsn::Exception);
+}
+
+BOOST_AUTO_TEST_CASE(timers_on_full_queue)
+{
+    using namespace dsn;
+    for (auto policy : { overflow_policy::block, overflow_policy::reject, overflow_policy::caller_runs,
+             overflow_policy::drop_oldest }) {
+        thread_pool_options options;
+        options.num_threads = 1;
+        options.queue_capacity = 1;
+        options.overflow = policy;
+        ThreadPool pool(options);
+
+        std::promise<void> gate;
+        std::shared_future<void> open = gate.get_future().share();
+        std::promise<void> started;
+        pool.post([open, &started]() {
+            started.set_value();
+            open.wait();
+        });
+        started.get_future().wait();
+        std::atomic<bool> filler{ false };
+        BOOST_REQUIRE(pool.try_post([&filler]() { filler = true; }));
+
+        // callbacks must never run on the timer thread, and a full queue must neither stall it nor lose them
+        std::atomic<bool> outside_worker{ false };
+        std::atomic<bool> once{ false };
+        std::atomic<int> runs{ 0 };
+        pool.schedule_after(std::chrono::milliseconds(1), [&pool, &once, &outside_worker]() {
+            outside_worker = outside_worker || !pool.is_worker_thread();
+            once = true;
+        });
+        auto id = pool.schedule_every(std::chrono::milliseconds(1), [&pool, &runs, &outside_worker]() {
+            outside_worker = outside_worker || !pool.is_worker_thread();
+            runs++;
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        BOOST_CHECK(!once);
+        BOOST_CHECK(runs == 0);
+        BOOST_CHECK(pool.pending_timers() == 2);
+        const auto before = dsn::chrono::clock_type::now();
+        BOOST_CHECK(pool.cancel_timer(id));
+        BOOST_CHECK(dsn::chrono::clock_type::now() - before < std::chrono::seconds(1));
+
+        gate.set_value();
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!once && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        BOOST_CHECK(once);
+        BOOST_CHECK(filler);
+        BOOST_CHECK(!outside_worker);
+        BOOST_CHECK(pool.pending_timers() == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(many_timers)
+{
+    using namespace dsn;
+    ThreadPool pool(4);
+
+    const size_t num_timers{ 5000 };
+    std::atomic<size_t> fired{ 0 };
+    std::vector<ThreadPool::timer_id> ids;
+    for (size_t i = 0; i < num_timers; ++i) {
+        ids.push_back(pool.schedule_after(std::chrono::microseconds((i * 7919) % 20000), [&fired]() { fired++; }));
+    }
+
+    size_t cancelled{ 0 };
+    for (size_t i = 0; i < num_timers; i += 10) {
+        if (pool.cancel_timer(ids[i])) {
+            cancelled++;
+        }
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (fired + cancelled < num_timers && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_CHECK(fired + cancelled == num_timers);
+    BOOST_CHECK(pool.pending_timers() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(metrics)
+{
+    using namespace dsn;
+    thread_pool_options options;
+    options.num_threads = 2;
+    ThreadPool pool(options);
+
+    // disabled by default
+    BOOST_CHECK(!pool.metrics_enabled());
+    pool.enqueue([]() {}).get();
+    BOOST_CHECK(pool.metrics().submitted == 0);
+
+    if (!pool.enable_metrics(true)) {
+        BOOST_CHECK(!ThreadPool::metrics_supported());
+        return;
+    }
+    BOOST_CHECK(pool.metrics_enabled());
+
+    {
+        auto gate = block_worker(pool);
+        auto gate2 = block_worker(pool);
+        const size_t num_tasks{ 100 };
+        std::vector<std::future<void> > results;
+        for (size_t i = 0; i < num_tasks; ++i) {
+            results.push_back(pool.enqueue([]() { std::this_thread::sleep_for(std::chrono::microseconds(100)); }));
+        }
+        BOOST_CHECK(pool.metrics().queue_depth == num_tasks);
+        gate->set_value();
+        gate2->set_value();
+        for (auto& result : results) {
+            result.get();
+        }
+    }
+    while (!pool.idle()) {
+        std::this_thread::yield();
+    }
+
+    auto m = pool.metrics();
+    BOOST_CHECK(m.submitted == 102);
+    BOOST_CHECK(m.completed == 102);
+    BOOST_CHECK(m.queue_depth == 0);
+    BOOST_CHECK(m.peak_queue_depth >= 100);
+
+    unsigned long long waits{ 0 }, runs{ 0 }, long_runs{ 0 };
+    for (size_t i = 0; i < thread_pool_metrics::histogram_buckets; ++i) {
+        waits += m.queue_wait[i];
+        runs += m.execution_time[i];
+        if (thread_pool_metrics::bucket_floor(i) >= std::chrono::microseconds(64)) {
+            long_runs += m.execution_time[i];
+        }
+    }
+    BOOST_CHECK(waits == 102);
+    BOOST_CHECK(runs == 102);
+    BOOST_CHECK(long_runs >= 100);
+
+    BOOST_REQUIRE(m.busy_ratio.size() == 2);
+    BOOST_CHECK(m.busy_ratio[0] + m.busy_ratio[1] > 0.0);
+    BOOST_CHECK(m.busy_ratio[0] <= 1.0 && m.busy_ratio[1] <= 1.0);
+
+    pool.reset_metrics();
+    BOOST_CHECK(pool.metrics().submitted == 0);
+    pool.enable_metrics(false);
+    pool.enqueue([]() {}).get();
+    BOOST_CHECK(pool.metrics().submitted == 0);
+}
+
+BOOST_AUTO_TEST_CASE(lock_free_queue)
+{
+    using namespace dsn;
+    thread_pool_options options;
+    options.num_threads = 4;
+    options.queue_mode = queue_policy::lock_free;
+    options.ring_capacity = 16;
+
+    {
+        ThreadPool pool(options);
+        BOOST_CHECK(pool.queue_mode() == queue_policy::lock_free);
+
+        // more tasks than the ring holds spill over into the locked queue
+        const size_t num_tasks{ 10000 };
+        std::atomic<size_t> completed{ 0 };
+        std::vector<std::future<size_t> > results;
+        for (size_t i = 0; i < num_tasks; ++i) {
+            results.push_back(pool.enqueue([&completed, i]() {
+                completed++;
+                return i;
+            }));
+        }
+        std::vector<std::function<void()> > batch(num_tasks, [&completed]() { completed++; });
+        pool.post_bulk(batch.begin(), batch.end());
+
+        for (size_t i = 0; i < num_tasks; ++i) {
+            BOOST_CHECK(results[i].get() == i);
+        }
+        while (!pool.idle()) {
+            std::this_thread::yield();
+        }
+        BOOST_CHECK(completed == 2 * num_tasks);
+        BOOST_CHECK(pool.queue_depth(0) == 0);
+    }
+
+    // features that need the locked queue disable the ring
+    options.priority_levels = 2;
+    BOOST_CHECK(ThreadPool(options).queue_mode() == queue_policy::locked);
+    options.priority_levels = 1;
+    options.queue_capacity = 8;
+    BOOST_CHECK(ThreadPool(options).queue_mode() == queue_policy::locked);
+    options.queue_capacity = 0;
+    options.max_threads = 8;
+    BOOST_CHECK(ThreadPool(options).queue_mode() == queue_policy::locked);
+}
+
+BOOST_AUTO_TEST_CASE(queue_policy_benchmark)
+{
+    using Clock = std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using namespace dsn;
+
+    const size_t num_tasks{ 128000 };
+    for (size_t producers = 1; producers <= 64; producers *= 2) {
+        long long times[2];
+        for (int mode = 0; mode < 2; ++mode) {
+            thread_pool_options options;
+            options.num_threads = 4;
+            options.queue_mode = mode == 0 ? queue_policy::locked : queue_policy::lock_free;
+            ThreadPool pool(options);
+
+            std::atomic<size_t> completed{ 0 };
+            auto start = Clock::now();
+            std::vector<std::thread> threads;
+            for (size_t p = 0; p < producers; ++p) {
+                threads.emplace_back([&pool, &completed, producers]() {
+                    for (size_t i = 0; i < num_tasks / producers; ++i) {
+                        pool.post([&completed]() { completed++; });
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            while (completed != num_tasks) {
+                std::this_thread::yield();
+            }
+            times[mode] = duration_cast<microseconds>(Clock::now() - start).count();
+        }
+
+        std::cout << num_tasks << " tasks from " << producers << " producers, locked: " << times[0]
+                  << "us, lock_free: " << times[1] << "us" << std::endl;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(worker_hooks_and_context)
+{
+    using namespace dsn;
+
+    struct scratch {
+        explicit scratch(std::atomic<int>& live)
+            : m_live(live)
+        {
+            m_live++;
+        }
+        ~scratch() { m_live--; }
+
+        std::atomic<int>& m_live;
+        size_t uses{ 0 };
+    };
+
+    // the hooks and tasks run on the workers, so they only count failures for the checks below
+    std::atomic<int> started{ 0 }, stopped{ 0 }, live{ 0 }, wrong_index{ 0 }, missing_context{ 0 };
+    ThreadPool* self{ nullptr };
+    thread_pool_options options;
+    options.num_threads = 3;
+    options.on_worker_stop = [&](size_t) {
+        if (self->worker_context<scratch>() == nullptr) {
+            missing_context++;
+        }
+        stopped++;
+    };
+
+    {
+        std::unique_ptr<ThreadPool> pool;
+        // the hooks may run before the constructor returns, so publish the pool first
+        std::mutex construction;
+        {
+            std::lock_guard<std::mutex> lock(construction);
+            options.on_worker_start = [&](size_t index) {
+                { std::lock_guard<std::mutex> wait(construction); }
+                if (self->worker_index() != index) {
+                    wrong_index++;
+                }
+                self->set_worker_context(std::make_shared<scratch>(live));
+                started++;
+            };
+            pool.reset(new ThreadPool(options));
+            self = pool.get();
+        }
+
+        BOOST_CHECK(pool->worker_index() == ThreadPool::no_worker);
+        BOOST_CHECK(pool->worker_context<scratch>() == nullptr);
+        BOOST_CHECK_THROW(pool->set_worker_context(nullptr), dsn::Exception);
+
+        // tasks can index per-worker arrays without atomics
+        std::vector<size_t> per_worker(pool->worker_slots(), 0);
+        std::vector<std::future<void> > results;
+        for (size_t i = 0; i < 300; ++i) {
+            results.push_back(pool->enqueue([&pool, &per_worker, &wrong_index]() {
+                const size_t index = pool->worker_index();
+                if (index >= per_worker.size()) {
+                    wrong_index++;
+                    return;
+                }
+                per_worker[index]++;
+                pool->worker_context<scratch>()->uses++;
+            }));
+        }
+        for (auto& result : results) {
+            result.get();
+        }
+
+        size_t total{ 0 };
+        for (auto count : per_worker) {
+            total += count;
+        }
+        BOOST_CHECK(wrong_index == 0);
+        BOOST_CHECK(total == 300);
+        BOOST_CHECK(started == 3);
+        BOOST_CHECK(live == 3);
+    }
+
+    BOOST_CHECK(stopped == 3);
+    BOOST_CHECK(missing_context == 0);
+    BOOST_CHECK(live == 0);
+}
+
+BOOST_AUTO_TEST_CASE(stop_hook_while_slot_is_reused)
+{
+    // the first retiring worker takes its time in its stop hook and posts from it while tasks are waiting
+    std::atomic<bool> first{ true }, hook_started{ false }, hook_done{ false };
+    std::atomic<int> in_slot[2] = { { 0 }, { 0 } };
+    std::atomic<int> overlaps{ 0 }, missing_context{ 0 }, post_failed{ 0 };
+    ThreadPool* self{ nullptr };
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.max_threads = 2;
+    options.grow_threshold = std::chrono::milliseconds(1);
+    options.keep_alive = std::chrono::milliseconds(20);
+    options.on_worker_stop = [&](size_t index) {
+        if (first.exchange(false)) {
+            hook_started = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            try {
+                self->post([]() {});
+            } catch (const dsn::Exception&) {
+                post_failed++;
+            }
+            hook_done = true;
+        }
+        in_slot[index]--;
+    };
+
+    std::unique_ptr<ThreadPool> pool;
+    std::mutex construction;
+    {
+        std::lock_guard<std::mutex> lock(construction);
+        options.on_worker_start = [&](size_t index) {
+            { std::lock_guard<std::mutex> wait(construction); }
+            if (in_slot[index]++ != 0) {
+                overlaps++;
+            }
+            self->set_worker_context(std::make_shared<size_t>(index));
+        };
+        pool.reset(new ThreadPool(options));
+        self = pool.get();
+    }
+
+    auto check_context = [&pool, &missing_context]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto context = pool->worker_context<size_t>();
+        if (!context || *context != pool->worker_index()) {
+            missing_context++;
+        }
+    };
+
+    auto gate = block_worker(*pool);
+    for (size_t i = 0; i < 4 && pool->num_workers() < 2; ++i) {
+        pool->post(check_context);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    gate->set_value();
+    BOOST_REQUIRE(pool->num_workers() == 2);
+    while (!hook_started) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // queue tasks until the stop hook is done; its slot must not be handed to a new thread meanwhile
+    gate = block_worker(*pool);
+    while (!hook_done) {
+        pool->post(check_context);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    gate->set_value();
+
+    for (size_t i = 0; i < 20; ++i) {
+        pool->post(check_context);
+    }
+    BOOST_CHECK(pool->enqueue([]() { return 1; }).get() == 1);
+    while (!pool->idle()) {
+        std::this_thread::yield();
+    }
+
+    BOOST_CHECK(overlaps == 0);
+    BOOST_CHECK(missing_context == 0);
+    BOOST_CHECK(post_failed == 0);
+}
+
+BOOST_AUTO_TEST_CASE(blocking_regions)
+{
+    dsn::thread_pool_options options;
+    options.num_threads = 2;
+    options.max_compensating = 2;
+    ThreadPool pool(options);
+    BOOST_CHECK(pool.max_workers() == 2);
+    BOOST_CHECK(pool.worker_slots() == 4);
+
+    // outside of a worker this is a no-op
+    {
+        auto region = pool.blocking();
+    }
+    BOOST_CHECK(pool.num_workers() == 2);
+
+    // both workers block; without compensation the third task would have to wait for them
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    std::atomic<size_t> blocked{ 0 };
+    std::vector<std::future<void> > waiters;
+    for (size_t i = 0; i < 2; ++i) {
+        waiters.push_back(pool.enqueue([&pool, &blocked, open]() {
+            auto region = pool.blocking();
+            blocked++;
+            open.wait();
+        }));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (blocked < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_REQUIRE(blocked == 2);
+    BOOST_CHECK(pool.num_workers() == 4);
+
+    auto cpu_task = pool.enqueue([]() { return 42; });
+    BOOST_REQUIRE(cpu_task.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    BOOST_CHECK(cpu_task.get() == 42);
+
+    gate.set_value();
+    for (auto& waiter : waiters) {
+        waiter.get();
+    }
+
+    // compensating workers retire once the regions ended
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (pool.num_workers() > 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_CHECK(pool.num_workers() == 2);
+    BOOST_CHECK(pool.enqueue([]() { return 1; }).get() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(shutdown_now_returns_queued_tasks)
+{
+    ThreadPool pool(1);
+    auto gate = block_worker(pool);
+
+    std::atomic<size_t> ran{ 0 };
+    for (size_t i = 0; i < 10; ++i) {
+        pool.post([&ran]() { ran++; });
+    }
+    auto result = pool.enqueue([]() { return 42; });
+
+    auto stopping = std::async(std::launch::async, [&pool]() { return pool.shutdown_now(); });
+
+    // once submissions are rejected the workers won't start another task
+    size_t extra{ 0 };
+    for (;;) {
+        try {
+            pool.post([&ran]() { ran++; });
+            extra++;
+        } catch (const dsn::Exception&) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    gate->set_value();
+
+    auto tasks = stopping.get();
+    BOOST_CHECK(ran == 0);
+    BOOST_CHECK(tasks.size() == 11 + extra);
+    BOOST_CHECK(pool.num_workers() == 0);
+    BOOST_CHECK_THROW(pool.enqueue([]() {}), dsn::Exception);
+
+    for (auto& task : tasks) {
+        task();
+    }
+    BOOST_CHECK(ran == 10 + extra);
+    BOOST_CHECK(result.get() == 42);
+}
+
+BOOST_AUTO_TEST_CASE(shutdown_with_deadline)
+{
+    {
+        ThreadPool pool(2);
+        std::atomic<size_t> ran{ 0 };
+        for (size_t i = 0; i < 100; ++i) {
+            pool.post([&ran]() { ran++; });
+        }
+        BOOST_CHECK(pool.shutdown(dsn::chrono::clock_type::now() + std::chrono::seconds(10)) == 0);
+        BOOST_CHECK(ran == 100);
+    }
+
+    ThreadPool pool(1);
+    auto gate = block_worker(pool);
+    std::atomic<size_t> ran{ 0 };
+    std::vector<std::future<void> > results;
+    for (size_t i = 0; i < 10; ++i) {
+        results.push_back(pool.enqueue([&ran]() { ran++; }));
+    }
+
+    // the running task is waited for, the queued ones are discarded once the deadline has passed
+    std::thread opener([gate]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        gate->set_value();
+    });
+    BOOST_CHECK(pool.shutdown(dsn::chrono::clock_type::now() + std::chrono::milliseconds(20)) == 10);
+    opener.join();
+
+    BOOST_CHECK(ran == 0);
+    for (auto& result : results) {
+        BOOST_CHECK_THROW(result.get(), std::future_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stop_races_with_submissions)
+{
+    for (auto mode : { dsn::queue_policy::locked, dsn::queue_policy::lock_free }) {
+        dsn::thread_pool_options options;
+        options.num_threads = 2;
+        options.queue_mode = mode;
+        ThreadPool pool(options);
+
+        // every accepted task has to run, every other one has to be rejected with an exception
+        std::atomic<size_t> accepted{ 0 }, ran{ 0 };
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < 4; ++p) {
+            producers.emplace_back([&]() {
+                for (;;) {
+                    try {
+                        pool.post([&ran]() { ran++; });
+                        accepted++;
+                    } catch (const dsn::Exception&) {
+                        return;
+                    }
+                }
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.stop();
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        BOOST_CHECK(accepted > 0);
+        BOOST_CHECK(ran == accepted);
+    }
+}
@@ -0,0 +1,153 @@
+#define BOOST_TEST_MODULE "dsn::coro"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <dsnutil/threadpool_coroutine.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+std::atomic<size_t> allocations{ 0 };
+}
+
+// all replaceable forms are replaced so that every allocation is paired with a matching malloc()/free()
+void* operator new(size_t size)
+{
+    allocations++;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+#endif
+
+namespace {
+dsn::coro::task<int> square_on(dsn::ThreadPool& pool, int value)
+{
+    co_await pool.schedule();
+    // this runs on a worker, so a wrong thread shows up in the result instead of a check here
+    co_return pool.is_worker_thread() ? value * value : -1;
+}
+
+dsn::coro::task<int> sum_of_squares(dsn::ThreadPool& pool, int n)
+{
+    int sum{ 0 };
+    for (int i = 1; i <= n; ++i) {
+        sum += co_await square_on(pool, i);
+    }
+    co_return sum;
+}
+
+dsn::coro::task<> fail(dsn::ThreadPool& pool)
+{
+    co_await pool.schedule();
+    throw std::runtime_error("failed");
+}
+}
+
+BOOST_AUTO_TEST_CASE(schedule_and_sync_wait)
+{
+    dsn::ThreadPool pool(2);
+    BOOST_CHECK(dsn::coro::sync_wait(square_on(pool, 7)) == 49);
+    BOOST_CHECK(dsn::coro::sync_wait(sum_of_squares(pool, 10)) == 385);
+    BOOST_CHECK_THROW(dsn::coro::sync_wait(fail(pool)), std::runtime_error);
+
+    auto moved = [&pool](std::unique_ptr<int> value) -> dsn::coro::task<std::unique_ptr<int> > {
+        co_await pool.schedule();
+        co_return std::move(value);
+    };
+    BOOST_CHECK(*dsn::coro::sync_wait(moved(std::unique_ptr<int>(new int(5)))) == 5);
+}
+
+BOOST_AUTO_TEST_CASE(many_coroutines_few_workers)
+{
+    dsn::ThreadPool pool(2);
+
+    const size_t num_coroutines{ 5000 };
+    std::atomic<size_t> finished{ 0 };
+    std::promise<void> all_done;
+
+    auto worker = [&](size_t hops) -> dsn::coro::task<> {
+        for (size_t i = 0; i < hops; ++i) {
+            // every hop suspends the coroutine without holding a thread
+            co_await pool.schedule();
+        }
+        if (++finished == num_coroutines) {
+            all_done.set_value();
+        }
+    };
+
+    for (size_t i = 0; i < num_coroutines; ++i) {
+        dsn::coro::spawn(pool, worker(3));
+    }
+    BOOST_CHECK(all_done.get_future().wait_for(std::chrono::seconds(30)) == std::future_status::ready);
+    BOOST_CHECK(finished == num_coroutines);
+}
+
+BOOST_AUTO_TEST_CASE(resume_does_not_allocate)
+{
+    // the lock-free ring is preallocated, so only the resumption task itself could allocate
+    dsn::thread_pool_options options;
+    options.num_threads = 1;
+    options.queue_mode = dsn::queue_policy::lock_free;
+    dsn::ThreadPool pool(options);
+
+    auto hops = [&pool](size_t count) -> dsn::coro::task<size_t> {
+        co_await pool.schedule();
+        const size_t before = allocations;
+        for (size_t i = 0; i < count; ++i) {
+            co_await pool.schedule();
+        }
+        co_return allocations - before;
+    };
+    BOOST_CHECK(dsn::coro::sync_wait(hops(100)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(dropped_resumption)
+{
+    dsn::ThreadPool pool(1);
+    std::promise<void> gate;
+    std::shared_future<void> open(gate.get_future());
+    std::promise<void> started;
+    pool.post([open, &started]() {
+        started.set_value();
+        open.wait();
+    });
+    started.get_future().wait();
+
+    // the coroutine's resumption is queued behind the blocked worker and discarded by shutdown_now()
+    auto result = std::async(std::launch::async, [&pool]() { return dsn::coro::sync_wait(square_on(pool, 3)); });
+    while (pool.queue_depth(0) == 0) {
+        std::this_thread::yield();
+    }
+    std::thread release([&gate]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        gate.set_value();
+    });
+    BOOST_CHECK(pool.shutdown_now().size() == 1);
+    release.join();
+
+    BOOST_REQUIRE(result.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    BOOST_CHECK_THROW(result.get(), dsn::Exception);
+
+    // awaiting a stopped pool fails right away
+    BOOST_CHECK_THROW(dsn::coro::sync_wait(square_on(pool, 3)), dsn::Exception);
+}